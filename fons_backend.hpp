@@ -1,30 +1,32 @@
 #pragma once
 
 #include "fontstash.hpp"
+#include <cstddef>
 #include <cstring>
 #include <cmath>
 
 
 #ifdef FONS_SDL_RENDERER
 
+#include <SDL2/SDL_version.h>
+#include <SDL2/SDL_render.h>
+
 #if    FONS_CLEARTYPE && defined(__GNUC__)
     #warning "Current FONS_CLEARTYPE is experimental"
 #elif  FONS_CLEARTYPE && defined(_MSC_VER)
     #pragma message("Current FONS_CLEARTYPE is experimental")
 #endif
 
-#if    SDL_VERSION_ATLEAST(2,0,10)
-    #define SDL_RenderDrawPoint SDL_RenderDrawPointF
-#endif
-
-#include <SDL2/SDL_version.h>
-#include <SDL2/SDL_render.h>
-
 FONS_NS_BEGIN
 
-//FIXME : It has a bug when the font color is changed.(if you want to avoid it,flush after draw_text)
-
-
+/**
+ * @brief TextRenderer by SDL_Renderer,each atlas page is a streaming texture
+ * 
+ * @note Glyphs are batched by SDL_RenderGeometry(SDL 2.0.18) or SDL_RenderCopy,colored by modulation
+ * @note On FONS_CLEARTYPE each batch is drawn twice with per channel blend modes,
+ *       renderers without the custom blend modes get a gray scale alpha approximation
+ * @note SDF glyphs are not supported(no shader to decode them),set_sdf(true) is asserted
+ */
 class SDLTextRenderer : public TextRenderer {
     public:
         SDLTextRenderer(SDL_Renderer *r,Fontstash &m,int w = 512,int h = 512);
@@ -33,192 +35,316 @@ class SDLTextRenderer : public TextRenderer {
         void set_color(SDL_Color);
         void set_color(Color    );
     private:
-        void render_update(int x,int y,int w,int h) override;
+        void render_update(int page,int x,int y,int w,int h) override;
         void render_resize(int w,int h) override;
         void render_draw(const Vertex *vertices,int nvertices) override;
         void render_flush() override;
+        /**
+         * @brief Get the texture of the page,create and upload it if not exists
+         * 
+         * @param page 
+         * @return SDL_Texture* (nullptr on failure)
+         */
+        SDL_Texture *texture_of(int page);
+        void         upload(SDL_Texture *texture,int page,int x,int y,int w,int h);
+        void         destroy_textures();
+        /**
+         * @brief Draw the glyphs in the same page
+         * 
+         * @param mask Modulate by the alpha only(the first ClearType pass)
+         */
+        void         draw_batch(SDL_Texture *texture,const Vertex *vertices,int nvertices,bool mask);
+        /**
+         * @brief Unpack RRGGBBAA to the modulation color
+         * 
+         */
+        static SDL_Color color_of(Color c);
+        static SDL_Color mask_color_of(Color c);
 
-        SDL_Renderer *renderer;
-        SDL_Texture  *texture;
-        SDL_PixelFormat *format;
+        SDL_Renderer             *renderer;
+        std::vector<SDL_Texture*> textures;//< Indexed by page
+#if FONS_CLEARTYPE
+        bool                      subpixel_blend = true;//< The renderer supports mask_mode and add_mode
+        SDL_BlendMode             mask_mode;//< dst * (1 - coverage * alpha)
+        SDL_BlendMode             add_mode; //< dst + color * coverage * alpha
+#endif
+#if SDL_VERSION_ATLEAST(2,0,18)
+        std::vector<SDL_Vertex>   geometry;
+        std::vector<int>          indices;
+#endif
 };
 
 inline SDLTextRenderer::SDLTextRenderer(SDL_Renderer *r,Fontstash &m,int w,int h)
     : TextRenderer(m,w,h)
     , renderer(r)
-    , texture(nullptr)
 {
-    // texture = SDL_CreateTexture(
-    //     renderer,
-    //     SDL_PIXELFORMAT_RGBA32,
-    //     SDL_TEXTUREACCESS_STREAMING,
-    //     w,
-    //     h
-    // );
-    // Uint32 fmt = SDL_MasksToPixelFormatEnum(
-    //     32,
-    //     0xFF000000,
-    //     0x00FF0000,
-    //     0x0000FF00,
-    //     0x00000000
-    // );
-    // format = SDL_AllocFormat(SDL_PIXELFORMAT_RGBA32);
-    // SDL_SetTextureBlendMode(texture,SDL_BLENDMODE_BLEND);
+    set_sdf_support(false);
+#if FONS_CLEARTYPE
+    mask_mode = SDL_ComposeCustomBlendMode(
+        SDL_BLENDFACTOR_ZERO,
+        SDL_BLENDFACTOR_ONE_MINUS_SRC_COLOR,
+        SDL_BLENDOPERATION_ADD,
+        SDL_BLENDFACTOR_ZERO,
+        SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA,
+        SDL_BLENDOPERATION_ADD
+    );
+    add_mode = SDL_ComposeCustomBlendMode(
+        SDL_BLENDFACTOR_ONE,
+        SDL_BLENDFACTOR_ONE,
+        SDL_BLENDOPERATION_ADD,
+        SDL_BLENDFACTOR_ONE,
+        SDL_BLENDFACTOR_ONE,
+        SDL_BLENDOPERATION_ADD
+    );
+#endif
 }
 inline SDLTextRenderer::~SDLTextRenderer(){
-    // SDL_DestroyTexture(texture);
-    // SDL_FreeFormat(format);
+    destroy_textures();
 }
-inline void SDLTextRenderer::render_update(int x,int y,int w,int h){
-    //Nothing to do
+inline void SDLTextRenderer::destroy_textures(){
+    for(SDL_Texture *texture : textures){
+        if(texture != nullptr){
+            SDL_DestroyTexture(texture);
+        }
+    }
+    textures.clear();
+}
+inline SDL_Texture *SDLTextRenderer::texture_of(int page){
+    if(page < int(textures.size()) && textures[page] != nullptr){
+        return textures[page];
+    }
+    if(page >= int(textures.size())){
+        textures.resize(page + 1,nullptr);
+    }
+    int w,h;
+    get_atlas_size(&w,&h);
+    SDL_Texture *texture = SDL_CreateTexture(
+        renderer,
+        SDL_PIXELFORMAT_RGBA32,
+        SDL_TEXTUREACCESS_STREAMING,
+        w,
+        h
+    );
+    if(texture == nullptr){
+        FONS_LOG("SDL_CreateTexture failed: %s",SDL_GetError());
+        return nullptr;
+    }
+#if FONS_CLEARTYPE
+    if(subpixel_blend){
+        subpixel_blend = SDL_SetTextureBlendMode(texture,mask_mode) == 0 &&
+                         SDL_SetTextureBlendMode(texture,add_mode) == 0;
+        if(!subpixel_blend){
+            FONS_LOG("Per channel blending is not supported,ClearType falls back to gray scale alpha");
+        }
+    }
+    //Fallback:texture and color are premultiplied,blended by the max coverage
+    SDL_BlendMode mode = SDL_ComposeCustomBlendMode(
+        SDL_BLENDFACTOR_ONE,
+        SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA,
+        SDL_BLENDOPERATION_ADD,
+        SDL_BLENDFACTOR_ONE,
+        SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA,
+        SDL_BLENDOPERATION_ADD
+    );
+    if(SDL_SetTextureBlendMode(texture,mode) != 0){
+        SDL_SetTextureBlendMode(texture,SDL_BLENDMODE_BLEND);
+    }
+#else
+    SDL_SetTextureBlendMode(texture,SDL_BLENDMODE_BLEND);
+#endif
+    textures[page] = texture;
+    //The content of new texture is undefined,upload the whole page
+    upload(texture,page,0,0,w,h);
+    return texture;
+}
+inline void SDLTextRenderer::upload(SDL_Texture *texture,int page,int x,int y,int w,int h){
+    if(w <= 0 || h <= 0){
+        return;
+    }
+    SDL_Rect rect = {x,y,w,h};
+    void *pixels;
+    int   pitch;
+    if(SDL_LockTexture(texture,&rect,&pixels,&pitch) != 0){
+        FONS_LOG("SDL_LockTexture failed: %s",SDL_GetError());
+        return;
+    }
+    int tex_w;
+    const Pixel *src = static_cast<const Pixel*>(get_data(page,&tex_w,nullptr));
+    //Convert coverage to RGBA
+    for(int row = 0;row < h;row++){
+        const Pixel *s = src + (y + row) * tex_w + x;
+        uint8_t     *d = static_cast<uint8_t*>(pixels) + row * pitch;
+        for(int col = 0;col < w;col++){
+#if FONS_CLEARTYPE
+            //Unpack ClearType pixels to three coverages
+            uint8_t r = (s[col] >> 24) & 0xFF;
+            uint8_t g = (s[col] >> 16) & 0xFF;
+            uint8_t b = (s[col] >> 8) & 0xFF;
+            d[0] = r;
+            d[1] = g;
+            d[2] = b;
+            d[3] = std::max(r,std::max(g,b));
+#else
+            //Gray scale mode,white with coverage alpha
+            d[0] = 0xFF;
+            d[1] = 0xFF;
+            d[2] = 0xFF;
+            d[3] = s[col];
+#endif
+            d += 4;
+        }
+    }
+    SDL_UnlockTexture(texture);
+}
+inline void SDLTextRenderer::render_update(int page,int x,int y,int w,int h){
+    bool created = page < int(textures.size()) && textures[page] != nullptr;
+    SDL_Texture *texture = texture_of(page);
+    if(texture != nullptr && created){
+        upload(texture,page,x,y,w,h);
+    }
 }
 inline void SDLTextRenderer::render_flush(){
-    //Nothing to do
+    //Nothing to do,SDL_Renderer batches itself
 }
 inline void SDLTextRenderer::render_resize(int w,int h){
-    // SDL_DestroyTexture(texture);
-    // texture = SDL_CreateTexture(
-    //     renderer,
-    //     SDL_PIXELFORMAT_RGBA32,
-    //     SDL_TEXTUREACCESS_STREAMING,
-    //     w,
-    //     h
-    // );
-    // SDL_SetTextureBlendMode(texture,SDL_BLENDMODE_BLEND);
+    //Recreated by size of the atlas on next use
+    LILIM_UNUSED(w);
+    LILIM_UNUSED(h);
+    destroy_textures();
+}
+inline SDL_Color SDLTextRenderer::color_of(Color c){
+    SDL_Color color;
+    //Unpack color by RRGGBBAA
+    color.r = (c >> 24) & 0xFF;
+    color.g = (c >> 16) & 0xFF;
+    color.b = (c >> 8) & 0xFF;
+    color.a =  c & 0xFF;
+#if FONS_CLEARTYPE
+    //Premultiply for the blend mode
+    color.r = color.r * color.a / 255;
+    color.g = color.g * color.a / 255;
+    color.b = color.b * color.a / 255;
+#endif
+    return color;
+}
+inline SDL_Color SDLTextRenderer::mask_color_of(Color c){
+    SDL_Color color;
+    color.r = c & 0xFF;
+    color.g = c & 0xFF;
+    color.b = c & 0xFF;
+    color.a = c & 0xFF;
+    return color;
 }
 inline void SDLTextRenderer::render_draw(const Vertex *vertices,int nvertices){
-    //SDL_DrawPoint version
-    SDL_SetRenderDrawBlendMode(renderer,SDL_BLENDMODE_BLEND);
-
+    int n = 0;
+    while(n < nvertices){
+        //Batch the glyphs in the same page
+        int page = vertices[n].page;
+        int end  = n;
+        while(end < nvertices && vertices[end].page == page){
+            end++;
+        }
+        SDL_Texture *texture = texture_of(page);
+        if(texture == nullptr){
+            n = end;
+            continue;
+        }
+#if FONS_CLEARTYPE
+        if(subpixel_blend){
+            //dst = dst * (1 - coverage * a) + color * coverage * a,per channel
+            //The glyphs overlapped in a batch are all masked before adding
+            SDL_SetTextureBlendMode(texture,mask_mode);
+            draw_batch(texture,vertices + n,end - n,true);
+            SDL_SetTextureBlendMode(texture,add_mode);
+            draw_batch(texture,vertices + n,end - n,false);
+            n = end;
+            continue;
+        }
+#endif
+        draw_batch(texture,vertices + n,end - n,false);
+        n = end;
+    }
+}
+inline void SDLTextRenderer::draw_batch(SDL_Texture *texture,const Vertex *vertices,int nvertices,bool mask){
     int tex_w,tex_h;
-    void *tex = get_data(&tex_w,&tex_h);
-    //For all glyph and draw it
-    for(int n = 0;n < nvertices;n++){
-        const Vertex &vert = vertices[n];
+    get_atlas_size(&tex_w,&tex_h);
+    float itw = 1.0f / tex_w;
+    float ith = 1.0f / tex_h;
 
-        Pixel *src = static_cast<Pixel*>(tex);
-        //Unpack color by RRGGBBAA
-        uint8_t r = (vert.c >> 24) & 0xFF;
-        uint8_t g = (vert.c >> 16) & 0xFF;
-        uint8_t b = (vert.c >> 8) & 0xFF;
-        uint8_t a =  vert.c & 0xFF;
-        //For this glyph and draw point
-        for(int y = 0;y < vert.glyph_h;y++){
-            for(int x = 0;x < vert.glyph_w;x++){
-                Pixel pixel = src[((y + vert.glyph_y) * tex_w) + (x + vert.glyph_x)];
-
-                if(pixel == 0){
-                    continue;
-                }
-                //Zero is transparent,if not,draw it
-#if FONS_CLEARTYPE
-                //TODO : ClearType(This version works bad on Black Color)
-                //Unpack ClearType pixels to three GrayScale
-                float ra = (pixel >> 24) & 0xFF;
-                float ga = (pixel >> 16) & 0xFF;
-                float ba = (pixel >> 8) & 0xFF;
+#if SDL_VERSION_ATLEAST(2,0,18)
+    geometry.clear();
+    indices.clear();
+    for(int i = 0;i < nvertices;i++){
+        const Vertex &vert = vertices[i];
+        SDL_Color color = mask ? mask_color_of(vert.c) : color_of(vert.c);
+
+        float x0 = vert.screen_x;
+        float y0 = vert.screen_y;
+        float x1 = vert.screen_x + vert.screen_w;
+        float y1 = vert.screen_y + vert.screen_h;
+        float s0 = vert.glyph_x * itw;
+        float t0 = vert.glyph_y * ith;
+        float s1 = (vert.glyph_x + vert.glyph_w) * itw;
+        float t1 = (vert.glyph_y + vert.glyph_h) * ith;
 
-                uint8_t new_r = (r * ra) / 255;
-                uint8_t new_g = (g * ga) / 255;
-                uint8_t new_b = (b * ba) / 255;
+        int base = int(geometry.size());
+        geometry.push_back({{x0,y0},color,{s0,t0}});
+        geometry.push_back({{x1,y0},color,{s1,t0}});
+        geometry.push_back({{x1,y1},color,{s1,t1}});
+        geometry.push_back({{x0,y1},color,{s0,t1}});
 
-                SDL_SetRenderDrawColor(renderer,new_r,new_g,new_b,a);
+        indices.push_back(base + 0);
+        indices.push_back(base + 1);
+        indices.push_back(base + 2);
+        indices.push_back(base + 0);
+        indices.push_back(base + 2);
+        indices.push_back(base + 3);
+    }
+    SDL_RenderGeometry(
+        renderer,
+        texture,
+        geometry.data(),
+        int(geometry.size()),
+        indices.data(),
+        int(indices.size())
+    );
 #else
-                //Gray scale mode
-                uint8_t alpha = a * float(pixel) / 255.0f;
-                SDL_SetRenderDrawColor(renderer,r,g,b,alpha);
-#endif
-                SDL_RenderDrawPoint(renderer,vert.screen_x + x,vert.screen_y + y);
-            }
+    LILIM_UNUSED(itw);
+    LILIM_UNUSED(ith);
+    //Change modulation only when the color changed
+    Color current = ~vertices[0].c;
+    for(int i = 0;i < nvertices;i++){
+        const Vertex &vert = vertices[i];
+        if(vert.c != current){
+            current = vert.c;
+            SDL_Color color = mask ? mask_color_of(vert.c) : color_of(vert.c);
+            SDL_SetTextureColorMod(texture,color.r,color.g,color.b);
+            SDL_SetTextureAlphaMod(texture,color.a);
         }
-    }
+        SDL_Rect glyph_rect;
+        glyph_rect.x = vert.glyph_x;
+        glyph_rect.y = vert.glyph_y;
+        glyph_rect.w = vert.glyph_w;
+        glyph_rect.h = vert.glyph_h;
+    #if SDL_VERSION_ATLEAST(2,0,10)
+        SDL_FRect dst_rect;
+        dst_rect.x = vert.screen_x;
+        dst_rect.y = vert.screen_y;
+        dst_rect.w = vert.screen_w;
+        dst_rect.h = vert.screen_h;
 
+        SDL_RenderCopyF(renderer,texture,&glyph_rect,&dst_rect);
+    #else
+        SDL_Rect dst_rect;
+        dst_rect.x = vert.screen_x;
+        dst_rect.y = vert.screen_y;
+        dst_rect.w = vert.screen_w;
+        dst_rect.h = vert.screen_h;
 
-    //Do 
-    // int tex_w,tex_h;
-    // void *tex = get_data(&tex_w,&tex_h);
-
-    // SDL_Color color;
-
-    // void *pixels;
-    // int   pitch;
-
-    // //Lock !
-    // if(SDL_LockTexture(texture,nullptr,&pixels,&pitch) != 0){
-    //     printf("SDL_LockTexture failed: %s\n",SDL_GetError());
-    //     LILIM_ASSERT(false);
-    // }
-    
-    // for(int n = 0;n < nvertices;n++){
-    //     const Vertex &vert = vertices[n];
-
-    //     //Begin Update
-    //     SDL_Rect glyph_rect;
-    //     glyph_rect.x = vert.glyph_x;
-    //     glyph_rect.y = vert.glyph_y;
-    //     glyph_rect.w = vert.glyph_w;
-    //     glyph_rect.h = vert.glyph_h;
-
-    //     //Copy
-    //     uint8_t *src = static_cast<uint8_t*>(tex);
-    //     uint8_t *dst = static_cast<uint8_t*>(pixels);
-
-    //     for(int y = 0;y < vert.glyph_h;y++){
-    //         for(int x = 0;x < vert.glyph_w;x++){
-    //             uint8_t * cur_dst = dst + ((y + vert.glyph_y) * pitch) + ((x + vert.glyph_x) * 4);
-    //             uint8_t * cur_src = src + ((y + vert.glyph_y) * tex_w) + (x + vert.glyph_x);
-
-    //             //Unpack color by RRGGBBAA
-    //             uint8_t r = (vert.c >> 24) & 0xFF;
-    //             uint8_t g = (vert.c >> 16) & 0xFF;
-    //             uint8_t b = (vert.c >> 8) & 0xFF;
-    //             uint8_t a = vert.c & 0xFF;
-
-    //             //Map it to the texture
-    //             a *= float(*cur_src) / 255.0f;
-
-    //             (*(uint32_t*)cur_dst) = SDL_MapRGBA(
-    //                 format,
-    //                 r,
-    //                 g,
-    //                 b,
-    //                 *cur_src
-    //             );
-    //         }
-    //     }
-    // }
-    // //Update done
-    // SDL_UnlockTexture(texture);
-
-    // //Draw !
-    // for(int n = 0;n < nvertices;n++){
-    //     const Vertex &vert = vertices[n];
-
-    //     SDL_Rect glyph_rect;
-    //     glyph_rect.x = vert.glyph_x;
-    //     glyph_rect.y = vert.glyph_y;
-    //     glyph_rect.w = vert.glyph_w;
-    //     glyph_rect.h = vert.glyph_h;
-
-// #if SDL_VERSION_ATLEAST(2,0,10)
-        // Use float version
-        // SDL_FRect dst_rect;
-        // dst_rect.x = vert.screen_x;
-        // dst_rect.y = vert.screen_y;
-        // dst_rect.w = vert.screen_w;
-        // dst_rect.h = vert.screen_h;
-
-        // SDL_RenderCopyF(renderer,texture,&glyph_rect,&dst_rect);
-// #else
-        // SDL_Rect dst_rect;
-        // dst_rect.x = vert.screen_x;
-        // dst_rect.y = vert.screen_y;
-        // dst_rect.w = vert.screen_w;
-        // dst_rect.h = vert.screen_h;
-
-        // SDL_RenderCopy(renderer,texture,&glyph_rect,&dst_rect);
-// #endif
-    // }
+        SDL_RenderCopy(renderer,texture,&glyph_rect,&dst_rect);
+    #endif
+    }
+#endif
 }
 inline void SDLTextRenderer::set_color(Color c){
     Context::set_color(c);
@@ -236,24 +362,729 @@ inline void SDLTextRenderer::set_color(SDL_Color c){
 
 FONS_NS_END
 
-//Cleanup
-#undef SDL_RenderDrawPoint
-
 #endif
 
 
 #ifdef FONS_GL_RENDERER
 
+//Include your OpenGL 3.3 core loader(glad,GLEW,...) before this header
+
 FONS_NS_BEGIN
 
+/**
+ * @brief TextRenderer by OpenGL 3.3 core
+ * 
+ * @note Pages are layers of a texture array,vertices are instances streamed by a ring buffer,
+ *       so each flush is one draw call
+ */
 class GLTextRenderer : public TextRenderer {
     public:
         GLTextRenderer(Fontstash &m,int w = 512,int h = 512);
+        GLTextRenderer(const GLTextRenderer &) = delete;
         ~GLTextRenderer();
+        /**
+         * @brief Set the size of the drawable in pixels
+         * 
+         * @note 0 means query GL_VIEWPORT on each draw(default)
+         * 
+         * @param w 
+         * @param h 
+         */
+        void set_viewport(int w,int h){
+            viewport_w = w;
+            viewport_h = h;
+        }
     private:
-        GLuint vbo;
+        void render_update(int page,int x,int y,int w,int h) override;
+        void render_resize(int w,int h) override;
+        void render_draw(const Vertex *vertices,int nvertices) override;
+        void render_flush() override;
+        /**
+         * @brief Create the texture array for all pages and upload them
+         * 
+         */
+        void   create_texture();
+        void   upload(int page,int x,int y,int w,int h);
+        GLuint compile(GLenum type,const char *source);
+
+        GLuint     program = 0;
+        GLuint     vao = 0;
+        GLuint     vbo = 0;
+        GLuint     texture = 0;
+        GLint      loc_viewport = -1;
+        GLint      loc_atlas = -1;
+        int        layers = 0;//< Number of pages in texture
+        int        tex_w = 0;
+        int        tex_h = 0;
+        GLsizeiptr ring_size = 0;//< Bytes of vbo
+        GLintptr   ring_offset = 0;//< Next write position in vbo
+        int        viewport_w = 0;
+        int        viewport_h = 0;
 };
 
+inline GLTextRenderer::GLTextRenderer(Fontstash &m,int w,int h)
+    : TextRenderer(m,w,h)
+{
+    //A quad for each Vertex,corners from gl_VertexID
+    static const char *vert_source = R"(#version 330 core
+        layout(location = 0) in int   a_page;
+        layout(location = 1) in ivec4 a_glyph;  // w,h,x,y
+        layout(location = 2) in vec4  a_screen; // x,y,w,h
+        layout(location = 3) in uint  a_color;  // RRGGBBAA
+        layout(location = 4) in float a_sdf;    // sdf_scale
+        uniform vec2 u_viewport;
+        uniform vec2 u_atlas;
+        out vec3 v_uv;
+        out vec4 v_color;
+        flat out float v_sdf;
+        void main(){
+            vec2 corner = vec2(gl_VertexID & 1,gl_VertexID >> 1);
+            vec2 pos    = a_screen.xy + corner * a_screen.zw;
+            vec2 uv     = (vec2(a_glyph.zw) + corner * vec2(a_glyph.xy)) / u_atlas;
+            gl_Position = vec4(pos.x / u_viewport.x * 2.0 - 1.0,1.0 - pos.y / u_viewport.y * 2.0,0.0,1.0);
+            v_uv    = vec3(uv,float(a_page));
+            v_color = vec4(
+                float((a_color >> 24) & 0xFFu),
+                float((a_color >> 16) & 0xFFu),
+                float((a_color >> 8) & 0xFFu),
+                float(a_color & 0xFFu)
+            ) / 255.0;
+            v_sdf   = a_sdf;
+        }
+    )";
+#if FONS_CLEARTYPE
+    //Dual source blending,each channel has its own coverage
+    static const char *frag_source = R"(#version 330 core
+        uniform sampler2DArray u_texture;
+        uniform float u_spread;
+        in vec3 v_uv;
+        in vec4 v_color;
+        flat in float v_sdf;
+        layout(location = 0,index = 0) out vec4 o_color;
+        layout(location = 0,index = 1) out vec4 o_coverage;
+        void main(){
+            vec3 coverage = texture(u_texture,v_uv).rgb;
+            if(v_sdf > 0.0){
+                //Distance in screen pixels to coverage
+                float dist = (coverage.r * 255.0 - 128.0) / 128.0 * u_spread * v_sdf;
+                coverage = vec3(clamp(dist + 0.5,0.0,1.0));
+            }
+            coverage *= v_color.a;
+            o_color    = vec4(v_color.rgb * coverage,max(coverage.r,max(coverage.g,coverage.b)));
+            o_coverage = vec4(coverage,o_color.a);
+        }
+    )";
+#else
+    static const char *frag_source = R"(#version 330 core
+        uniform sampler2DArray u_texture;
+        uniform float u_spread;
+        in vec3 v_uv;
+        in vec4 v_color;
+        flat in float v_sdf;
+        out vec4 o_color;
+        void main(){
+            float alpha = texture(u_texture,v_uv).r;
+            if(v_sdf > 0.0){
+                //Distance in screen pixels to coverage
+                float dist = (alpha * 255.0 - 128.0) / 128.0 * u_spread * v_sdf;
+                alpha = clamp(dist + 0.5,0.0,1.0);
+            }
+            alpha *= v_color.a;
+            o_color = vec4(v_color.rgb * alpha,alpha);
+        }
+    )";
+#endif
+    GLuint vs = compile(GL_VERTEX_SHADER,vert_source);
+    GLuint fs = compile(GL_FRAGMENT_SHADER,frag_source);
+    program = glCreateProgram();
+    glAttachShader(program,vs);
+    glAttachShader(program,fs);
+    glLinkProgram(program);
+    glDeleteShader(vs);
+    glDeleteShader(fs);
+
+    GLint ok = GL_FALSE;
+    glGetProgramiv(program,GL_LINK_STATUS,&ok);
+    if(ok != GL_TRUE){
+        char log[512];
+        glGetProgramInfoLog(program,sizeof(log),nullptr,log);
+        FONS_LOG("Fail to link program: %s",log);
+    }
+    loc_viewport = glGetUniformLocation(program,"u_viewport");
+    loc_atlas    = glGetUniformLocation(program,"u_atlas");
+    glUseProgram(program);
+    glUniform1i(glGetUniformLocation(program,"u_texture"),0);
+    glUniform1f(glGetUniformLocation(program,"u_spread"),LILIM_SDF_SPREAD);
+    glUseProgram(0);
+
+    //Attributes are bound to the ring buffer on each draw
+    glGenVertexArrays(1,&vao);
+    glGenBuffers(1,&vbo);
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER,vbo);
+    for(GLuint loc = 0;loc < 5;loc++){
+        glEnableVertexAttribArray(loc);
+        glVertexAttribDivisor(loc,1);
+    }
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER,0);
+
+    //Pages could not be bigger than the texture
+    GLint max_size = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE,&max_size);
+    if(max_size > 0){
+        set_max_atlas_size(max_size);
+    }
+}
+inline GLTextRenderer::~GLTextRenderer(){
+    glDeleteTextures(1,&texture);
+    glDeleteBuffers(1,&vbo);
+    glDeleteVertexArrays(1,&vao);
+    glDeleteProgram(program);
+}
+inline GLuint GLTextRenderer::compile(GLenum type,const char *source){
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader,1,&source,nullptr);
+    glCompileShader(shader);
+
+    GLint ok = GL_FALSE;
+    glGetShaderiv(shader,GL_COMPILE_STATUS,&ok);
+    if(ok != GL_TRUE){
+        char log[512];
+        glGetShaderInfoLog(shader,sizeof(log),nullptr,log);
+        FONS_LOG("Fail to compile shader: %s",log);
+    }
+    return shader;
+}
+inline void GLTextRenderer::create_texture(){
+    if(texture == 0){
+        glGenTextures(1,&texture);
+    }
+    get_atlas_size(&tex_w,&tex_h);
+    layers = atlas_pages();
+
+    glBindTexture(GL_TEXTURE_2D_ARRAY,texture);
+#if FONS_CLEARTYPE
+    glTexImage3D(GL_TEXTURE_2D_ARRAY,0,GL_RGBA8,tex_w,tex_h,layers,0,GL_RGBA,GL_UNSIGNED_INT_8_8_8_8,nullptr);
+#else
+    glTexImage3D(GL_TEXTURE_2D_ARRAY,0,GL_R8,tex_w,tex_h,layers,0,GL_RED,GL_UNSIGNED_BYTE,nullptr);
+#endif
+    glTexParameteri(GL_TEXTURE_2D_ARRAY,GL_TEXTURE_MIN_FILTER,GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
+
+    //Content is undefined,upload all pages
+    for(int page = 0;page < layers;page++){
+        upload(page,0,0,tex_w,tex_h);
+    }
+}
+inline void GLTextRenderer::upload(int page,int x,int y,int w,int h){
+    if(w <= 0 || h <= 0){
+        return;
+    }
+    const Pixel *src = static_cast<const Pixel*>(get_data(page,nullptr,nullptr));
+
+    glBindTexture(GL_TEXTURE_2D_ARRAY,texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT,1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH,tex_w);
+    glTexSubImage3D(
+        GL_TEXTURE_2D_ARRAY,0,
+        x,y,page,
+        w,h,1,
+#if FONS_CLEARTYPE
+        GL_RGBA,GL_UNSIGNED_INT_8_8_8_8,
+#else
+        GL_RED,GL_UNSIGNED_BYTE,
+#endif
+        src + y * tex_w + x
+    );
+    glPixelStorei(GL_UNPACK_ROW_LENGTH,0);
+}
+inline void GLTextRenderer::render_update(int page,int x,int y,int w,int h){
+    int atlas_w,atlas_h;
+    get_atlas_size(&atlas_w,&atlas_h);
+    if(texture == 0 || page >= layers || atlas_w != tex_w || atlas_h != tex_h){
+        //New page or resized,all pages are uploaded
+        create_texture();
+        return;
+    }
+    upload(page,x,y,w,h);
+}
+inline void GLTextRenderer::render_resize(int w,int h){
+    //Recreated on next update or draw
+    LILIM_UNUSED(w);
+    LILIM_UNUSED(h);
+    layers = 0;
+}
+inline void GLTextRenderer::render_draw(const Vertex *vertices,int nvertices){
+    if(nvertices <= 0){
+        return;
+    }
+    if(texture == 0 || layers < atlas_pages()){
+        create_texture();
+    }
+    //Stream into the ring buffer
+    GLsizeiptr bytes = GLsizeiptr(sizeof(Vertex)) * nvertices;
+    glBindBuffer(GL_ARRAY_BUFFER,vbo);
+    if(bytes > ring_size){
+        //Grow,keep room for a few more draws
+        ring_size = 1024 * sizeof(Vertex);
+        while(ring_size < bytes * 4){
+            ring_size *= 2;
+        }
+        glBufferData(GL_ARRAY_BUFFER,ring_size,nullptr,GL_STREAM_DRAW);
+        ring_offset = 0;
+    }
+    else if(ring_offset + bytes > ring_size){
+        //Wrap around,orphan the storage so the pending draws are not stalled
+        glBufferData(GL_ARRAY_BUFFER,ring_size,nullptr,GL_STREAM_DRAW);
+        ring_offset = 0;
+    }
+    void *dst = glMapBufferRange(
+        GL_ARRAY_BUFFER,
+        ring_offset,
+        bytes,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT
+    );
+    if(dst == nullptr){
+        FONS_LOG("Fail to map vertex buffer");
+        glBindBuffer(GL_ARRAY_BUFFER,0);
+        return;
+    }
+    std::memcpy(dst,vertices,bytes);
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+
+    //Vertex is used as instance data directly
+    glBindVertexArray(vao);
+    GLsizei   stride = sizeof(Vertex);
+    GLintptr  base   = ring_offset;
+    glVertexAttribIPointer(0,1,GL_INT,stride,reinterpret_cast<void*>(base + offsetof(Vertex,page)));
+    glVertexAttribIPointer(1,4,GL_INT,stride,reinterpret_cast<void*>(base + offsetof(Vertex,glyph_w)));
+    glVertexAttribPointer(2,4,GL_FLOAT,GL_FALSE,stride,reinterpret_cast<void*>(base + offsetof(Vertex,screen_x)));
+    glVertexAttribIPointer(3,1,GL_UNSIGNED_INT,stride,reinterpret_cast<void*>(base + offsetof(Vertex,c)));
+    glVertexAttribPointer(4,1,GL_FLOAT,GL_FALSE,stride,reinterpret_cast<void*>(base + offsetof(Vertex,sdf_scale)));
+    ring_offset += bytes;
+
+    //Draw all in one call
+    int vw = viewport_w;
+    int vh = viewport_h;
+    if(vw <= 0 || vh <= 0){
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT,viewport);
+        vw = viewport[2];
+        vh = viewport[3];
+    }
+    glUseProgram(program);
+    glUniform2f(loc_viewport,vw,vh);
+    glUniform2f(loc_atlas,tex_w,tex_h);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY,texture);
+    glEnable(GL_BLEND);
+#if FONS_CLEARTYPE
+    glBlendFunc(GL_ONE,GL_ONE_MINUS_SRC1_COLOR);
+#else
+    glBlendFunc(GL_ONE,GL_ONE_MINUS_SRC_ALPHA);
+#endif
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP,0,4,nvertices);
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER,0);
+    glUseProgram(0);
+}
+inline void GLTextRenderer::render_flush(){
+    //Nothing to do,vertices are drawn in render_draw
+}
+
 FONS_NS_END
 
-#endif
\ No newline at end of file
+#endif
+
+
+#ifdef FONS_CPU_RENDERER
+
+#include <climits>
+
+//SIMD for blending
+#if !defined(FONS_NO_SIMD)
+    #if defined(__AVX2__)
+        #include <immintrin.h>
+        #define FONS_AVX2
+        #define FONS_SSE2
+    #elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+        #include <emmintrin.h>
+        #define FONS_SSE2
+    #endif
+#endif
+
+FONS_NS_BEGIN
+
+/**
+ * @brief TextRenderer without GPU,blend glyphs into a RGBA framebuffer
+ * 
+ * @note The position is rounded to the nearest pixel,scaled glyphs(SDF and placeholder)
+ *       are sampled bilinearly and the distance field is decoded like the GL shader
+ */
+class CPUTextRenderer : public TextRenderer {
+    public:
+        CPUTextRenderer(Fontstash &m,int w = 512,int h = 512);
+        /**
+         * @brief Set the framebuffer to draw into
+         * 
+         * @note Pixels are R,G,B,A bytes(straight alpha),blended by source over
+         * 
+         * @param pixels 
+         * @param width 
+         * @param height 
+         * @param pitch Bytes of a row
+         */
+        void set_target(void *pixels,int width,int height,int pitch);
+        /**
+         * @brief Set the clip rect in the framebuffer
+         * 
+         * @note It is applied to the pending vertices on flush
+         * 
+         * @param x 
+         * @param y 
+         * @param w 
+         * @param h 
+         */
+        void set_clip(int x,int y,int w,int h);
+        void reset_clip();
+        /**
+         * @brief Blend a row of the glyph into the framebuffer(SIMD if available)
+         * 
+         * @param dst The framebuffer pixels
+         * @param src The atlas pixels
+         * @param n The number of pixels
+         * @param c The color(RRGGBBAA)
+         */
+        static void blend_row(uint8_t *dst,const Pixel *src,int n,Color c);
+        /**
+         * @brief Same as blend_row without SIMD(used for the tail)
+         * 
+         */
+        static void blend_row_scalar(uint8_t *dst,const Pixel *src,int n,Color c);
+    private:
+        void render_update(int page,int x,int y,int w,int h) override;
+        void render_resize(int w,int h) override;
+        void render_draw(const Vertex *vertices,int nvertices) override;
+        void render_flush() override;
+        /**
+         * @brief Draw a SDF glyph or a glyph whose screen size differs from the bitmap
+         * 
+         */
+        void draw_scaled(const Vertex &vert,int minx,int miny,int maxx,int maxy);
+
+        uint8_t *target = nullptr;
+        int      target_w = 0;
+        int      target_h = 0;
+        int      target_pitch = 0;
+        int      clip[4] = {0,0,INT_MAX,INT_MAX};//< minx,miny,maxx,maxy
+        std::vector<Pixel> scaled_row;//< Coverage of a row from draw_scaled
+};
+
+//Rounded x / 255 for x in [0,255 * 255]
+inline unsigned int Div255(unsigned int x){
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+#ifdef FONS_SSE2
+inline __m128i Div255(__m128i x){
+    x = _mm_add_epi16(x,_mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(x,_mm_srli_epi16(x,8)),8);
+}
+//dst = (src * f + dst * (255 - f)) / 255 on 16 bits lanes
+inline __m128i BlendLanes(__m128i dst,__m128i src,__m128i f){
+    __m128i inv = _mm_sub_epi16(_mm_set1_epi16(255),f);
+    return Div255(_mm_add_epi16(_mm_mullo_epi16(src,f),_mm_mullo_epi16(dst,inv)));
+}
+#if FONS_CLEARTYPE
+//Lanes [0,b,g,r] of two pixels to [r,g,b,max(r,g,b)]
+inline __m128i CoverageLanes(__m128i p){
+    p = _mm_shufflelo_epi16(p,_MM_SHUFFLE(0,1,2,3));
+    p = _mm_shufflehi_epi16(p,_MM_SHUFFLE(0,1,2,3));
+    p = _mm_and_si128(p,_mm_set_epi16(0,-1,-1,-1,0,-1,-1,-1));
+    __m128i s1 = _mm_shufflehi_epi16(_mm_shufflelo_epi16(p,_MM_SHUFFLE(3,0,2,1)),_MM_SHUFFLE(3,0,2,1));
+    __m128i s2 = _mm_shufflehi_epi16(_mm_shufflelo_epi16(p,_MM_SHUFFLE(3,1,0,2)),_MM_SHUFFLE(3,1,0,2));
+    __m128i mx = _mm_max_epi16(p,_mm_max_epi16(s1,s2));
+    mx = _mm_shufflehi_epi16(_mm_shufflelo_epi16(mx,_MM_SHUFFLE(0,3,3,3)),_MM_SHUFFLE(0,3,3,3));
+    return _mm_or_si128(p,mx);
+}
+#endif
+#endif
+#ifdef FONS_AVX2
+inline __m256i Div255(__m256i x){
+    x = _mm256_add_epi16(x,_mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(x,_mm256_srli_epi16(x,8)),8);
+}
+inline __m256i BlendLanes(__m256i dst,__m256i src,__m256i f){
+    __m256i inv = _mm256_sub_epi16(_mm256_set1_epi16(255),f);
+    return Div255(_mm256_add_epi16(_mm256_mullo_epi16(src,f),_mm256_mullo_epi16(dst,inv)));
+}
+#if FONS_CLEARTYPE
+inline __m256i CoverageLanes(__m256i p){
+    p = _mm256_shufflelo_epi16(p,_MM_SHUFFLE(0,1,2,3));
+    p = _mm256_shufflehi_epi16(p,_MM_SHUFFLE(0,1,2,3));
+    p = _mm256_and_si256(p,_mm256_set_epi16(0,-1,-1,-1,0,-1,-1,-1,0,-1,-1,-1,0,-1,-1,-1));
+    __m256i s1 = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(p,_MM_SHUFFLE(3,0,2,1)),_MM_SHUFFLE(3,0,2,1));
+    __m256i s2 = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(p,_MM_SHUFFLE(3,1,0,2)),_MM_SHUFFLE(3,1,0,2));
+    __m256i mx = _mm256_max_epi16(p,_mm256_max_epi16(s1,s2));
+    mx = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(mx,_MM_SHUFFLE(0,3,3,3)),_MM_SHUFFLE(0,3,3,3));
+    return _mm256_or_si256(p,mx);
+}
+#endif
+#endif
+
+inline CPUTextRenderer::CPUTextRenderer(Fontstash &m,int w,int h)
+    : TextRenderer(m,w,h)
+{
+
+}
+inline void CPUTextRenderer::set_target(void *pixels,int width,int height,int pitch){
+    target       = static_cast<uint8_t*>(pixels);
+    target_w     = width;
+    target_h     = height;
+    target_pitch = pitch;
+}
+inline void CPUTextRenderer::set_clip(int x,int y,int w,int h){
+    clip[0] = x;
+    clip[1] = y;
+    clip[2] = x + w;
+    clip[3] = y + h;
+}
+inline void CPUTextRenderer::reset_clip(){
+    clip[0] = 0;
+    clip[1] = 0;
+    clip[2] = INT_MAX;
+    clip[3] = INT_MAX;
+}
+inline void CPUTextRenderer::render_update(int page,int x,int y,int w,int h){
+    //Nothing to do,the atlas is read directly
+    LILIM_UNUSED(page);
+    LILIM_UNUSED(x);
+    LILIM_UNUSED(y);
+    LILIM_UNUSED(w);
+    LILIM_UNUSED(h);
+}
+inline void CPUTextRenderer::render_resize(int w,int h){
+    LILIM_UNUSED(w);
+    LILIM_UNUSED(h);
+}
+inline void CPUTextRenderer::render_flush(){
+    //Nothing to do
+}
+inline void CPUTextRenderer::render_draw(const Vertex *vertices,int nvertices){
+    if(target == nullptr){
+        return;
+    }
+    //Clip rect in framebuffer
+    int minx = std::max(clip[0],0);
+    int miny = std::max(clip[1],0);
+    int maxx = std::min(clip[2],target_w);
+    int maxy = std::min(clip[3],target_h);
+
+    int tex_w;
+    for(int n = 0;n < nvertices;n++){
+        const Vertex &vert = vertices[n];
+        if(vert.sdf_scale > 0 || vert.screen_w != vert.glyph_w || vert.screen_h != vert.glyph_h){
+            draw_scaled(vert,minx,miny,maxx,maxy);
+            continue;
+        }
+        const Pixel *src = static_cast<const Pixel*>(get_data(vert.page,&tex_w,nullptr));
+
+        int x0 = int(std::floor(vert.screen_x + 0.5f));
+        int y0 = int(std::floor(vert.screen_y + 0.5f));
+        int cx0 = std::max(x0,minx);
+        int cy0 = std::max(y0,miny);
+        int cx1 = std::min(x0 + vert.glyph_w,maxx);
+        int cy1 = std::min(y0 + vert.glyph_h,maxy);
+        if(cx0 >= cx1 || cy0 >= cy1){
+            continue;
+        }
+        for(int y = cy0;y < cy1;y++){
+            const Pixel *s = src + (vert.glyph_y + y - y0) * tex_w + vert.glyph_x + (cx0 - x0);
+            uint8_t     *d = target + y * target_pitch + cx0 * 4;
+            blend_row(d,s,cx1 - cx0,vert.c);
+        }
+    }
+}
+inline void CPUTextRenderer::draw_scaled(const Vertex &vert,int minx,int miny,int maxx,int maxy){
+    if(vert.glyph_w <= 0 || vert.glyph_h <= 0 || vert.screen_w <= 0 || vert.screen_h <= 0){
+        return;
+    }
+    int tex_w;
+    const Pixel *src = static_cast<const Pixel*>(get_data(vert.page,&tex_w,nullptr));
+
+    int x0 = int(std::floor(vert.screen_x + 0.5f));
+    int y0 = int(std::floor(vert.screen_y + 0.5f));
+    int x1 = int(std::floor(vert.screen_x + vert.screen_w + 0.5f));
+    int y1 = int(std::floor(vert.screen_y + vert.screen_h + 0.5f));
+    int cx0 = std::max(x0,minx);
+    int cy0 = std::max(y0,miny);
+    int cx1 = std::min(x1,maxx);
+    int cy1 = std::min(y1,maxy);
+    if(cx0 >= cx1 || cy0 >= cy1){
+        return;
+    }
+    float sx = vert.glyph_w / vert.screen_w;
+    float sy = vert.glyph_h / vert.screen_h;
+    //Distance in screen pixels per unit of the 8 bits value,like the GL shader
+    float spread = LILIM_SDF_SPREAD * vert.sdf_scale / 128.0f;
+
+    //Bilinear in the glyph rect,shift selects the channel
+    auto sample = [&](float u,float v,int shift){
+        u = std::min(std::max(u,0.0f),float(vert.glyph_w - 1));
+        v = std::min(std::max(v,0.0f),float(vert.glyph_h - 1));
+        int   iu = int(u);
+        int   iv = int(v);
+        int   nu = std::min(iu + 1,vert.glyph_w - 1);
+        int   nv = std::min(iv + 1,vert.glyph_h - 1);
+        float fu = u - iu;
+        float fv = v - iv;
+        const Pixel *r0 = src + (vert.glyph_y + iv) * tex_w + vert.glyph_x;
+        const Pixel *r1 = src + (vert.glyph_y + nv) * tex_w + vert.glyph_x;
+        float a = (r0[iu] >> shift) & 0xFF;
+        float b = (r0[nu] >> shift) & 0xFF;
+        float c = (r1[iu] >> shift) & 0xFF;
+        float d = (r1[nu] >> shift) & 0xFF;
+        float top    = a + (b - a) * fu;
+        float bottom = c + (d - c) * fu;
+        return top + (bottom - top) * fv;
+    };
+#if FONS_CLEARTYPE
+    const int shifts[3] = {24,16,8};
+#else
+    const int shifts[1] = {0};
+#endif
+    scaled_row.resize(cx1 - cx0);
+    for(int y = cy0;y < cy1;y++){
+        float v = (y + 0.5f - vert.screen_y) * sy - 0.5f;
+        for(int x = cx0;x < cx1;x++){
+            float u = (x + 0.5f - vert.screen_x) * sx - 0.5f;
+            Pixel pix = 0;
+            if(vert.sdf_scale > 0){
+                //The distance is in every channel,decode to coverage
+                float dist = (sample(u,v,shifts[0]) - 128.0f) * spread;
+                float cov  = std::min(std::max(dist + 0.5f,0.0f),1.0f);
+                unsigned int value = unsigned(cov * 255.0f + 0.5f);
+                for(int shift : shifts){
+                    pix |= Pixel(value << shift);
+                }
+            }
+            else{
+                for(int shift : shifts){
+                    pix |= Pixel(unsigned(sample(u,v,shift) + 0.5f) << shift);
+                }
+            }
+            scaled_row[x - cx0] = pix;
+        }
+        blend_row(target + y * target_pitch + cx0 * 4,scaled_row.data(),cx1 - cx0,vert.c);
+    }
+}
+inline void CPUTextRenderer::blend_row(uint8_t *dst,const Pixel *src,int n,Color c){
+    int i = 0;
+#ifdef FONS_SSE2
+    //Unpack color by RRGGBBAA,the source alpha channel is opaque
+    unsigned int r = (c >> 24) & 0xFF;
+    unsigned int g = (c >> 16) & 0xFF;
+    unsigned int b = (c >> 8) & 0xFF;
+    unsigned int a =  c & 0xFF;
+#endif
+
+#ifdef FONS_AVX2
+    {
+        __m256i color = _mm256_set_epi16(
+            255,b,g,r,255,b,g,r,
+            255,b,g,r,255,b,g,r
+        );
+        __m256i alpha = _mm256_set1_epi16(a);
+        __m256i zero  = _mm256_setzero_si256();
+        for(;i + 8 <= n;i += 8){
+            __m256i d  = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i * 4));
+    #if FONS_CLEARTYPE
+            __m256i p  = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+            //Pixel 0,1 | 4,5 and 2,3 | 6,7 like the dst
+            __m256i f0 = Div255(_mm256_mullo_epi16(CoverageLanes(_mm256_unpacklo_epi8(p,zero)),alpha));
+            __m256i f1 = Div255(_mm256_mullo_epi16(CoverageLanes(_mm256_unpackhi_epi8(p,zero)),alpha));
+    #else
+            __m128i cov = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i));
+            cov = _mm_unpacklo_epi8(cov,_mm_setzero_si128());
+            cov = Div255(_mm_mullo_epi16(cov,_mm256_castsi256_si128(alpha)));
+            //Broadcast the factor of each pixel to its four channels
+            __m128i u  = _mm_unpacklo_epi16(cov,cov);
+            __m128i v  = _mm_unpackhi_epi16(cov,cov);
+            __m256i f0 = _mm256_inserti128_si256(
+                _mm256_castsi128_si256(_mm_unpacklo_epi32(u,u)),_mm_unpacklo_epi32(v,v),1
+            );
+            __m256i f1 = _mm256_inserti128_si256(
+                _mm256_castsi128_si256(_mm_unpackhi_epi32(u,u)),_mm_unpackhi_epi32(v,v),1
+            );
+    #endif
+            __m256i d0 = BlendLanes(_mm256_unpacklo_epi8(d,zero),color,f0);
+            __m256i d1 = BlendLanes(_mm256_unpackhi_epi8(d,zero),color,f1);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i * 4),_mm256_packus_epi16(d0,d1));
+        }
+    }
+#endif
+#ifdef FONS_SSE2
+    {
+        __m128i color = _mm_set_epi16(255,b,g,r,255,b,g,r);
+        __m128i alpha = _mm_set1_epi16(a);
+        __m128i zero  = _mm_setzero_si128();
+        for(;i + 4 <= n;i += 4){
+            __m128i d  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i * 4));
+    #if FONS_CLEARTYPE
+            __m128i p  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+            __m128i f0 = Div255(_mm_mullo_epi16(CoverageLanes(_mm_unpacklo_epi8(p,zero)),alpha));
+            __m128i f1 = Div255(_mm_mullo_epi16(CoverageLanes(_mm_unpackhi_epi8(p,zero)),alpha));
+    #else
+            int32_t bytes;
+            std::memcpy(&bytes,src + i,sizeof(bytes));
+            __m128i cov = _mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes),zero);
+            cov = Div255(_mm_mullo_epi16(cov,alpha));
+            cov = _mm_unpacklo_epi16(cov,cov);
+            __m128i f0 = _mm_unpacklo_epi32(cov,cov);
+            __m128i f1 = _mm_unpackhi_epi32(cov,cov);
+    #endif
+            __m128i d0 = BlendLanes(_mm_unpacklo_epi8(d,zero),color,f0);
+            __m128i d1 = BlendLanes(_mm_unpackhi_epi8(d,zero),color,f1);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4),_mm_packus_epi16(d0,d1));
+        }
+    }
+#endif
+    //Tail
+    blend_row_scalar(dst + i * 4,src + i,n - i,c);
+}
+inline void CPUTextRenderer::blend_row_scalar(uint8_t *dst,const Pixel *src,int n,Color c){
+    //Unpack color by RRGGBBAA,the source alpha channel is opaque
+    unsigned int r = (c >> 24) & 0xFF;
+    unsigned int g = (c >> 16) & 0xFF;
+    unsigned int b = (c >> 8) & 0xFF;
+    unsigned int a =  c & 0xFF;
+    for(int i = 0;i < n;i++){
+        uint8_t *d = dst + i * 4;
+#if FONS_CLEARTYPE
+        unsigned int cr = (src[i] >> 24) & 0xFF;
+        unsigned int cg = (src[i] >> 16) & 0xFF;
+        unsigned int cb = (src[i] >> 8) & 0xFF;
+        unsigned int fr = Div255(cr * a);
+        unsigned int fg = Div255(cg * a);
+        unsigned int fb = Div255(cb * a);
+        unsigned int fa = Div255(std::max(cr,std::max(cg,cb)) * a);
+#else
+        unsigned int fr = Div255(src[i] * a);
+        unsigned int fg = fr;
+        unsigned int fb = fr;
+        unsigned int fa = fr;
+#endif
+        d[0] = Div255(r * fr + d[0] * (255 - fr));
+        d[1] = Div255(g * fg + d[1] * (255 - fg));
+        d[2] = Div255(b * fb + d[2] * (255 - fb));
+        d[3] = Div255(255 * fa + d[3] * (255 - fa));
+    }
+}
+
+FONS_NS_END
+
+#endif
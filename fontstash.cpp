@@ -17,13 +17,29 @@
 //    misrepresented as being the original software.
 // 3. This notice may not be removed or altered from any source distribution.
 //
+#include <condition_variable>
 #include <algorithm>
 #include <climits>
+#include <cmath>
+#include <cstdarg>
 #include <cstring>
+#include <thread>
 
 #define _FONS_SOURCE_
 #include "fontstash.hpp"
 
+//SIMD for blur
+#if !defined(FONS_NO_SIMD)
+    #if defined(__AVX2__)
+        #include <immintrin.h>
+        #define FONS_AVX2
+        #define FONS_SSE2
+    #elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+        #include <emmintrin.h>
+        #define FONS_SSE2
+    #endif
+#endif
+
 FONS_NS_BEGIN
 
 #if FONS_CLEARTYPE
@@ -32,6 +48,171 @@ constexpr int bytes_per_pixels = 4;
 constexpr int bytes_per_pixels = 1;
 #endif
 
+//Blur from nanovg fontstash,a recursive filter in fixed point
+constexpr int blur_aprec = 16;
+constexpr int blur_zprec = 7;
+
+//Filter each byte column along y,forward then backward,the first and last rows are forced to zero
+static void BlurColumns(uint8_t *dst,int w,int h,int stride,int alpha){
+    int x = 0;
+#ifdef FONS_SSE2
+    //(alpha * d) >> 16 by mulhi,alpha is unsigned but mulhi is signed,so add d back if it wraps
+    __m128i zero = _mm_setzero_si128();
+    __m128i a    = _mm_set1_epi16(int16_t(alpha));
+    __m128i wrap = alpha >= 0x8000 ? _mm_set1_epi16(-1) : zero;
+#ifdef FONS_AVX2
+    __m256i a16    = _mm256_set1_epi16(int16_t(alpha));
+    __m256i wrap16 = _mm256_set1_epi16(alpha >= 0x8000 ? -1 : 0);
+    auto step16 = [&](uint8_t *p,__m256i z){
+        __m128i src = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m256i d = _mm256_sub_epi16(_mm256_slli_epi16(_mm256_cvtepu8_epi16(src),blur_zprec),z);
+        z = _mm256_add_epi16(z,_mm256_add_epi16(_mm256_mulhi_epi16(d,a16),_mm256_and_si256(d,wrap16)));
+        __m256i v = _mm256_srli_epi16(z,blur_zprec);
+        _mm_storeu_si128(
+            reinterpret_cast<__m128i*>(p),
+            _mm_packus_epi16(_mm256_castsi256_si128(v),_mm256_extracti128_si256(v,1))
+        );
+        return z;
+    };
+    for(;x + 16 <= w;x += 16){
+        uint8_t *col = dst + x;
+        __m256i z = _mm256_setzero_si256();
+        for(int y = 1;y < h;y++){
+            z = step16(col + y * stride,z);
+        }
+        std::memset(col + (h - 1) * stride,0,16);
+        z = _mm256_setzero_si256();
+        for(int y = h - 2;y >= 0;y--){
+            z = step16(col + y * stride,z);
+        }
+        std::memset(col,0,16);
+    }
+#endif
+    auto step8 = [&](uint8_t *p,__m128i z){
+        __m128i src = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p));
+        __m128i d = _mm_sub_epi16(_mm_slli_epi16(_mm_unpacklo_epi8(src,zero),blur_zprec),z);
+        z = _mm_add_epi16(z,_mm_add_epi16(_mm_mulhi_epi16(d,a),_mm_and_si128(d,wrap)));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(p),_mm_packus_epi16(_mm_srli_epi16(z,blur_zprec),zero));
+        return z;
+    };
+    for(;x + 8 <= w;x += 8){
+        uint8_t *col = dst + x;
+        __m128i z = zero;
+        for(int y = 1;y < h;y++){
+            z = step8(col + y * stride,z);
+        }
+        std::memset(col + (h - 1) * stride,0,8);
+        z = zero;
+        for(int y = h - 2;y >= 0;y--){
+            z = step8(col + y * stride,z);
+        }
+        std::memset(col,0,8);
+    }
+#endif
+    //Remaining columns
+    for(;x < w;x++){
+        uint8_t *col = dst + x;
+        int z = 0;
+        for(int y = 1;y < h;y++){
+            uint8_t &v = col[y * stride];
+            z += (alpha * ((int(v) << blur_zprec) - z)) >> blur_aprec;
+            v = uint8_t(z >> blur_zprec);
+        }
+        col[(h - 1) * stride] = 0;
+        z = 0;
+        for(int y = h - 2;y >= 0;y--){
+            uint8_t &v = col[y * stride];
+            z += (alpha * ((int(v) << blur_zprec) - z)) >> blur_aprec;
+            v = uint8_t(z >> blur_zprec);
+        }
+        col[0] = 0;
+    }
+}
+//Filter coefficient of the blur radius in blur_aprec fixed point
+static int BlurAlpha(int blur){
+    //Alpha such that 90% of the kernel is within the radius
+    float sigma = blur * 0.57735f;// 1 / sqrt(3)
+    return (1 << blur_aprec) * (1.0f - std::exp(-2.3f / (sigma + 1.0f)));
+}
+//Blur a rect of pixels in place(pitch in pixels),each byte channel is filtered alone
+static void BlurRect(Pixel *dst,int w,int h,int pitch,int blur){
+    if(blur < 1 || w < 2 || h < 2){
+        return;
+    }
+    int alpha = BlurAlpha(blur);
+
+    //Rows are filtered as columns of the transposed rect
+    std::vector<Pixel> transposed(size_t(w) * h);
+    auto transpose = [&](bool back){
+        for(int y = 0;y < h;y++){
+            for(int x = 0;x < w;x++){
+                if(back){
+                    dst[y * pitch + x] = transposed[x * h + y];
+                }
+                else{
+                    transposed[x * h + y] = dst[y * pitch + x];
+                }
+            }
+        }
+    };
+    auto bytes = reinterpret_cast<uint8_t*>(dst);
+    auto tbytes = reinterpret_cast<uint8_t*>(transposed.data());
+    //Two passes as nanovg(y then x)
+    for(int pass = 0;pass < 2;pass++){
+        BlurColumns(bytes,w * bytes_per_pixels,h,pitch * bytes_per_pixels,alpha);
+        transpose(false);
+        BlurColumns(tbytes,h * bytes_per_pixels,w,h * bytes_per_pixels,alpha);
+        transpose(true);
+    }
+}
+
+//Render the distance field of a resolved glyph into the atlas(pitch in pixels)
+static void RenderSDF(Glyph *g,Face *face,Pixel *dst,int pitch){
+#if FONS_CLEARTYPE
+    //Expand 8 bits distance into r,g,b
+    std::vector<uint8_t> sdf(size_t(g->width) * g->height);
+    face->render_sdf_glyph(g->index,sdf.data(),g->width,0,0);
+    for(int y = 0;y < g->height;y++){
+        for(int x = 0;x < g->width;x++){
+            uint32_t v = sdf[y * g->width + x];
+            dst[y * pitch + x] = (v << 24) | (v << 16) | (v << 8);
+        }
+    }
+#else
+    face->render_sdf_glyph(g->index,dst,pitch,0,0);
+#endif
+}
+//Rasterize a resolved glyph into the rect at dst(pitch in pixels),blurred if needed
+static void RasterGlyph(Glyph *g,Face *face,Pixel *dst,int pitch){
+    face->set_size(g->size);
+    face->set_subpixel(float(g->subpixel) / FONS_SUBPIXEL_LEVELS);
+
+    int pad = 0;
+    if(g->blur > 0 && g->width > 0){
+        //The rect may be reused,clear the padding
+        pad = g->blur + 1;
+        for(int row = 0;row < g->height;row++){
+            std::fill_n(dst + row * pitch,g->width,Pixel(0));
+        }
+    }
+    if(g->flags & FONS_GLYPH_SDF){
+        RenderSDF(g,face,dst,pitch);
+    }
+    else{
+        face->render_glyph(
+            g->index,
+            dst,
+            pitch * bytes_per_pixels,
+            pad,
+            pad
+        );
+    }
+    face->set_subpixel(0);
+    if(pad > 0){
+        BlurRect(dst,g->width,g->height,pitch,g->blur);
+    }
+}
+
 Font::Font(){
 
 }
@@ -45,191 +226,523 @@ Ref<Font> Font::clone(){
     );
     return stash->get_font(id);
 }
+void Font::reset_fallbacks(){
+    std::lock_guard<std::mutex> lock(stash->mutex);
+    fallbacks.clear();
+    stash->serial++;
+}
+void Font::add_fallback(int f){
+    if(f == id){
+        return;
+    }
+    std::lock_guard<std::mutex> lock(stash->mutex);
+    fallbacks.emplace_back(f);
+    stash->serial++;
+}
+CacheStats Font::cache_stats(){
+    std::lock_guard<std::mutex> lock(stash->mutex);
+    CacheStats stats = this->stats;
+    for(Shard *s : shards){
+        stats.hits += s->stats.hits;
+        stats.misses += s->stats.misses;
+        stats.evictions += s->stats.evictions;
+    }
+    return stats;
+}
+void Font::reset_stats(){
+    std::lock_guard<std::mutex> lock(stash->mutex);
+    stats = {};
+    for(Shard *s : shards){
+        s->stats = {};
+    }
+}
 
-Glyph *Font::get_glyph(FontParams param,int req_bitmap){
-    //Clear cache if too big
-    if(glyphs.size() > FONS_MAX_CACHED_GLYPHS){
-        FONS_LOG("Too many glyphs in cache, clear it");
-        glyphs.clear();
+void Font::release(Shard *s){
+    shards.erase(std::find(shards.begin(),shards.end(),s));
+    if(s->face.get() == face.get()){
+        face_taken = false;
+    }
+    stats.hits += s->stats.hits;
+    stats.misses += s->stats.misses;
+    stats.evictions += s->stats.evictions;
+}
+
+auto Font::size_info(Shard &s,float size) -> SizeInfo*{
+    int isize = size;
+    if(isize <= 0 || isize > FONS_MAX_FONT_SIZE){
+        //Out of cache range
+        return nullptr;
+    }
+    if(s.sizes.empty()){
+        s.sizes.resize(FONS_MAX_FONT_SIZE + 1);
+    }
+    return &s.sizes[isize];
+}
+FaceMetrics Font::metrics_of(Context *ctxt,float size){
+    Shard &s = *ctxt->shard_of(this);
+    SizeInfo *info = size_info(s,size);
+    if(info == nullptr){
+        return s.face->metrics(Uint(size));
+    }
+    if(!info->cached){
+        info->metrics = s.face->metrics(Uint(size));
+        info->cached  = true;
+    }
+    return info->metrics;
+}
+Int  Font::kerning(Context *ctxt,float size,char32_t prev,char32_t cur){
+#ifndef FONS_NO_KERNING
+    if(!has_kerning){
+        return 0;
+    }
+    Shard &s = *ctxt->shard_of(this);
+    return kerning_of(s,size,s.face->glyph_index(prev),s.face->glyph_index(cur));
+#else
+    LILIM_UNUSED(ctxt);
+    LILIM_UNUSED(size);
+    LILIM_UNUSED(prev);
+    LILIM_UNUSED(cur);
+    return 0;
+#endif
+}
+Int  Font::kerning_of(Shard &s,float size,Uint left,Uint right){
+    Face *face = s.face.get();
+    SizeInfo *info = size_info(s,size);
+    if(info == nullptr){
+        return face->kerning(Uint(size),left,right);
+    }
+    auto &cache = info->kerning;
+    if(!info->kerning_filled){
+        //Prefill from the whole kerning table if possible
+        int n = face->kerning_pairs(nullptr,0);
+        if(n > 0){
+            std::vector<KerningPair> pairs(n);
+            n = face->kerning_pairs(pairs.data(),n);
+            for(int i = 0;i < n;i++){
+                cache.insert(
+                    pairs[i].left,
+                    pairs[i].right,
+                    face->kerning(Uint(size),pairs[i].left,pairs[i].right)
+                );
+            }
+        }
+        info->kerning_filled = true;
+    }
+    Int value;
+    if(cache.find(left,right,&value)){
+        return value;
     }
+    if(cache.size() >= FONS_MAX_KERNING_PAIRS){
+        cache.clear();
+    }
+    value = face->kerning(Uint(size),left,right);
+    cache.insert(left,right,value);
+    return value;
+}
+Glyph *Font::get_glyph(FontParams param,int req_bitmap){
     //Check params
     if(param.size <= 0 || param.size > FONS_MAX_FONT_SIZE){
         FONS_LOG("Invalid font size");
         return nullptr;
     }
 
-    Glyph *g    = nullptr;
-    Face  *face = nullptr;
-    Uint   idx  = 0;
-    auto stash = param.context->stash;
     auto ctxt  = param.context;
+    Shard &s   = *ctxt->shard_of(this);
 
-    //find existing glyph
-    g = query_cache(param,req_bitmap);
-    
-    //No existing glyph, create one
-    if(g == nullptr){
-        if(face == nullptr){
-            face = get_face(param.codepoint);
-            idx  = face->glyph_index(param.codepoint);
-        }
-        //Get metrics
-        face->set_size(param.size);
+    //The handler may reset the atlas in alloc_rect and the glyph is gone with the cache,make it again once
+    for(int tries = 0;tries < 2;tries++){
+        //find existing glyph
+        Glyph *g = s.glyphs.find(param);
 
-        Glyph glyph;
-        auto m = face->build_glyph(idx);
+        //No existing glyph, create one
+        if(g == nullptr){
+            s.stats.misses++;
+            //Make room if too big
+            if(s.glyphs.size() >= FONS_MAX_CACHED_GLYPHS){
+                evict(s);
+            }
+            Uint  idx;
+            Face *face = get_face(s,param.codepoint,&idx);
+            //Get metrics
+            face->set_size(param.size);
+            face->set_subpixel(float(param.subpixel) / FONS_SUBPIXEL_LEVELS);
+
+            auto m = (param.flags & FONS_GLYPH_SDF) ? face->build_sdf_glyph(idx) : face->build_glyph(idx);
+            if(req_bitmap != FONS_GLYPH_BITMAP_REQUIRED){
+                face->set_subpixel(0);
+            }
+            if(param.blur > 0 && m.width > 0 && m.height > 0){
+                //Pad by the radius(and one pixel of zero border)
+                int pad = param.blur + 1;
+                m.width  += pad * 2;
+                m.height += pad * 2;
+                m.bitmap_left -= pad;
+                m.bitmap_top  += pad;
+            }
 
-        //Set glyph info
-        static_cast<GlyphMetrics&>(glyph) = m;
-        static_cast<FontParams&>(glyph) = param;
-        //Insert
-        auto iter = glyphs.insert(std::make_pair(param.codepoint,glyph));
-        g = &iter->second;
-    }
-    //Require bitmap but not created
-    if(req_bitmap && g->x < 0 && g->y < 0){
-        if(face == nullptr){
-            face = get_face(param.codepoint);
-            idx  = face->glyph_index(param.codepoint);
+            //Insert and set glyph info
+            g = s.glyphs.insert(param);
+            static_cast<GlyphMetrics&>(*g) = m;
+            g->face  = face;
+            g->index = idx;
         }
-        //do render
-        face->set_size(param.size);
-
-        int x,y;
-        auto m = face->build_glyph(idx);
+        else{
+            s.stats.hits++;
+        }
+        g->generation = ctxt->generation;
+        //Bitmap not required or created
+        if(!req_bitmap || g->x >= 0 || g->y >= 0){
+            return g;
+        }
+        int   x,y,page;
+        int   w = g->width;
+        int   h = g->height;
+        Face *face = g->face.get();
+        uint32_t resets = ctxt->reset_serial;
         //Alloc space
-        bool v = ctxt->atlas.add_rect(
-            m.width,
-            m.height,
-            &x,
-            &y
-        );
-        //Atlas full
-        if(!v){
-            //Try to slove it
-            if(!ctxt->handle_atlas_full()){
-                //No solution
-                FONS_LOG("Fail to add glyph to atlas");
-                return nullptr;
-            }
-            v = ctxt->atlas.add_rect(
-                m.width,
-                m.height,
-                &x,
-                &y
-            );
-            if(!v){
-                //No solution
-                FONS_LOG("Fail to add glyph to atlas");
-                return nullptr;
-            }
-            //Sloved
-            FONS_LOG("Success to slove atlas full");
+        if(!ctxt->alloc_rect(w,h,&page,&x,&y)){
+            //No solution
+            FONS_LOG("Fail to add glyph to atlas");
+            face->set_subpixel(0);
+            return nullptr;
+        }
+        if(ctxt->reset_serial != resets){
+            //Atlas reset by the handler,give the rect back
+            ctxt->pages[page]->atlas.free_rect(x,y,w,h);
+            face->set_subpixel(0);
+            continue;
         }
         //Mark the glyph position in atlas
         g->x = x;
         g->y = y;
-        //Rasterize
-        face->render_glyph(
-            idx,
-            ctxt->bitmap.data(),
-            ctxt->bitmap_w * bytes_per_pixels,
-            x,
-            y
-        );
-        if(param.blur > 0){
-            //TODO blur
+        g->page = page;
+        if(req_bitmap == FONS_GLYPH_BITMAP_DEFERRED){
+            //Rasterized with others by the context
+            ctxt->pending.push_back(g);
+            return g;
         }
+        //Rasterize(the face keeps the glyph loaded by build_glyph on a miss,no load again)
+        ctxt->raster_glyph(g,face);
         //Update dirty
-        int *dirty = ctxt->dirty_rect;
-        dirty[0] = std::min(dirty[0],x);
-        dirty[1] = std::min(dirty[1],y);
-        dirty[2] = std::max(dirty[2],x + g->width);
-        dirty[3] = std::max(dirty[3],y + g->height);
+        ctxt->pages[g->page]->mark_dirty(g->x,g->y,g->width,g->height);
+        return g;
     }
-    return g;
+    FONS_LOG("Atlas reset again while adding glyph");
+    return nullptr;
 }
-Face *Font::get_face(char32_t codepoint){
-    Uint idx = face->glyph_index(codepoint);
+Face *Font::get_face(Shard &s,char32_t codepoint,Uint *index){
+    Uint idx = s.face->glyph_index(codepoint);
     if(idx != 0){
         //Self has the glyph
-        return face.get();
-    }
-    //Query fallback
-    for(auto iter = fallbacks.begin();iter != fallbacks.end();){
-        Font *f = stash->get_font(*iter);
-        if(f == nullptr){
-            //Unexisting font
-            iter = fallbacks.erase(iter);
-            continue;
+        *index = idx;
+        return s.face.get();
+    }
+    //Resolved before?
+    Face *f = nullptr;
+    if(s.resolved.find(codepoint,&f,index)){
+        return f != nullptr ? f : s.face.get();
+    }
+    if(s.resolved.size() >= FONS_MAX_FALLBACK_CACHE){
+        s.resolved.clear();
+    }
+    //Query fallback(by the faces in this context)
+    std::vector<Ref<Font>> list;
+    {
+        std::lock_guard<std::mutex> lock(stash->mutex);
+        for(auto iter = fallbacks.begin();iter != fallbacks.end();){
+            auto it = stash->fonts.find(*iter);
+            if(it == stash->fonts.end()){
+                //Unexisting font
+                iter = fallbacks.erase(iter);
+                continue;
+            }
+            list.emplace_back(it->second);
+            ++iter;
         }
-        idx = f->face->glyph_index(codepoint);
+    }
+    for(auto &fallback : list){
+        Face *face = s.context->shard_of(fallback.get())->face.get();
+        idx = face->glyph_index(codepoint);
         if(idx != 0){
             //Found font has this glyph
-            return f->face.get();
+            s.resolved.insert(codepoint,face,idx);
+            *index = idx;
+            return face;
         }
-        ++iter;
     }
     //Oh,no.try callback
     if(stash->get_fallback != nullptr){
-        Font *f = stash->get_fallback(codepoint);
-        if(f != nullptr && f != this){
+        Font *fallback = stash->get_fallback(codepoint);
+        if(fallback != nullptr && fallback != this){
             //Add it to fallbacks,faster
-            fallbacks.push_back(f->get_id());
-            return f->face.get();
-        }
-    }
-    //Still no found :( ,use self
-    return face.get();
-}
-Glyph *Font::query_cache(FontParams param,int req_bitmap){
-    auto iter = glyphs.find(param.codepoint);
-    auto num  = glyphs.count(param.codepoint);
-
-    if(req_bitmap){
-        while(num){
-            auto &glyph = iter->second;
-            //Require bitmap,so we need check the blur and context 
-            //Make sure we doesnot mix different context
-            if(glyph.size == param.size && 
-               glyph.blur == param.blur && 
-               glyph.context == param.context){
-                //Found
-                return &glyph;
+            {
+                std::lock_guard<std::mutex> lock(stash->mutex);
+                //Contexts in other threads may have added it
+                if(std::find(fallbacks.begin(),fallbacks.end(),fallback->get_id()) == fallbacks.end()){
+                    fallbacks.push_back(fallback->get_id());
+                    //Drop the codepoints resolved without it in other contexts
+                    stash->serial++;
+                }
             }
-            --num;
-            ++iter;
+            s.resolved.clear();
+            Face *face = s.context->shard_of(fallback)->face.get();
+            idx = face->glyph_index(codepoint);
+            s.resolved.insert(codepoint,face,idx);
+            *index = idx;
+            return face;
         }
     }
-    else{
-        //No bitmap required,just check size
-        while(num){
-            auto &glyph = iter->second;
-            
-            if(glyph.size == param.size){
-                //Found
+    //Still no found :( ,use self and remember it
+    s.resolved.insert(codepoint,nullptr,0);
+    *index = 0;
+    return s.face.get();
+}
+void Font::evict(Shard &s){
+    Context *ctxt = s.context;
+    //Collect glyphs not used in current frame
+    std::vector<Glyph*> olds;
+    s.glyphs.for_each([&](Glyph &glyph){
+        if(glyph.generation != ctxt->generation){
+            olds.push_back(&glyph);
+        }
+    });
+    if(olds.empty()){
+        FONS_LOG("All cached glyphs are used in current frame");
+        return;
+    }
+    //Select the oldest ones
+    size_t n = std::min<size_t>(olds.size(),std::max(FONS_EVICT_GLYPHS,1));
+    auto age = [ctxt](const Glyph *g){
+        return ctxt->generation - g->generation;
+    };
+    std::nth_element(olds.begin(),olds.begin() + (n - 1),olds.end(),[&](Glyph *a,Glyph *b){
+        return age(a) > age(b);
+    });
+    for(size_t i = 0;i < n;i++){
+        Glyph *g = olds[i];
+        //Give the space back to atlas
+        if(g->x >= 0 && g->y >= 0){
+            ctxt->pages[g->page]->atlas.free_rect(g->x,g->y,g->width,g->height);
+        }
+        s.glyphs.erase(g);
+    }
+    s.stats.evictions += n;
+    ctxt->atlas_epoch++;
+}
+
+//KerningCache
+bool KerningCache::find(Uint left,Uint right,Int *value) const{
+    if(count == 0){
+        return false;
+    }
+    uint64_t key  = key_of(left,right);
+    size_t   mask = entries.size() - 1;
+    size_t   pos  = hash_of(key) & mask;
+    while(entries[pos].key != Empty){
+        if(entries[pos].key == key){
+            *value = entries[pos].value;
+            return true;
+        }
+        pos = (pos + 1) & mask;
+    }
+    return false;
+}
+void KerningCache::insert(Uint left,Uint right,Int value){
+    //Keep load factor under 0.5
+    if((count + 1) * 2 > entries.size()){
+        std::vector<Entry> old(entries.empty() ? 64 : entries.size() * 2,Entry{Empty,0});
+        old.swap(entries);
+        count = 0;
+        for(auto &e : old){
+            if(e.key != Empty){
+                insert(e.key >> 32,uint32_t(e.key),e.value);
+            }
+        }
+    }
+    uint64_t key  = key_of(left,right);
+    size_t   mask = entries.size() - 1;
+    size_t   pos  = hash_of(key) & mask;
+    while(entries[pos].key != Empty){
+        if(entries[pos].key == key){
+            entries[pos].value = value;
+            return;
+        }
+        pos = (pos + 1) & mask;
+    }
+    entries[pos].key   = key;
+    entries[pos].value = value;
+    count++;
+}
+void KerningCache::clear(){
+    entries.clear();
+    count = 0;
+}
+
+//FallbackCache
+static size_t FallbackHash(char32_t codepoint){
+    return size_t((uint64_t(codepoint) * 0x9E3779B97F4A7C15ull) >> 32);
+}
+bool FallbackCache::find(char32_t codepoint,Face **face,Uint *index) const{
+    if(count == 0){
+        return false;
+    }
+    size_t mask = entries.size() - 1;
+    size_t pos  = FallbackHash(codepoint) & mask;
+    while(entries[pos].codepoint != Empty){
+        if(entries[pos].codepoint == codepoint){
+            *face  = entries[pos].face;
+            *index = entries[pos].index;
+            return true;
+        }
+        pos = (pos + 1) & mask;
+    }
+    return false;
+}
+void FallbackCache::insert(char32_t codepoint,Face *face,Uint index){
+    //Keep load factor under 0.5
+    if((count + 1) * 2 > entries.size()){
+        std::vector<Entry> old(entries.empty() ? 64 : entries.size() * 2,Entry{Empty,0,nullptr});
+        old.swap(entries);
+        count = 0;
+        for(auto &e : old){
+            if(e.codepoint != Empty){
+                insert(e.codepoint,e.face,e.index);
+            }
+        }
+    }
+    size_t mask = entries.size() - 1;
+    size_t pos  = FallbackHash(codepoint) & mask;
+    while(entries[pos].codepoint != Empty){
+        if(entries[pos].codepoint == codepoint){
+            entries[pos].face  = face;
+            entries[pos].index = index;
+            return;
+        }
+        pos = (pos + 1) & mask;
+    }
+    entries[pos].codepoint = codepoint;
+    entries[pos].face      = face;
+    entries[pos].index     = index;
+    count++;
+}
+void FallbackCache::clear(){
+    entries.clear();
+    count = 0;
+}
+
+//GlyphCache
+uint32_t GlyphCache::hash_of(const FontParams &param){
+    uint64_t h = uint64_t(param.codepoint);
+    h ^= uint64_t(uint16_t(param.size)) << 32;
+    h ^= uint64_t(uint16_t(param.blur)) << 48;
+    h ^= uint64_t(uint16_t(param.flags)) << 24;
+    h ^= uint64_t(uint16_t(param.subpixel)) << 40;
+    h ^= uint64_t(reinterpret_cast<uintptr_t>(param.context)) * 0x9E3779B97F4A7C15ull;
+    //Mix (from murmur3 finalizer)
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33;
+    return uint32_t(h);
+}
+void   GlyphCache::place(uint32_t hash,uint32_t index){
+    size_t mask = slots.size() - 1;
+    size_t pos  = hash & mask;
+    while(slots[pos].index != 0){
+        pos = (pos + 1) & mask;
+    }
+    slots[pos].hash  = hash;
+    slots[pos].index = index;
+}
+void   GlyphCache::rehash(size_t capacity){
+    std::vector<Slot> old(capacity,Slot{0,0});
+    old.swap(slots);
+    for(auto &slot : old){
+        if(slot.index != 0){
+            place(slot.hash,slot.index);
+        }
+    }
+}
+Glyph *GlyphCache::find(const FontParams &param){
+    if(count == 0){
+        return nullptr;
+    }
+    uint32_t hash = hash_of(param);
+    size_t   mask = slots.size() - 1;
+    size_t   pos  = hash & mask;
+    while(slots[pos].index != 0){
+        if(slots[pos].hash == hash){
+            Glyph &glyph = storage[slots[pos].index - 1];
+            if(same_key(glyph,param)){
                 return &glyph;
             }
-            --num;
-            ++iter;
         }
+        pos = (pos + 1) & mask;
     }
-    //Not found
     return nullptr;
 }
-//Clear cache of specified context
-void Font::clear_cache_of(Context *ctxt){
-    auto iter = glyphs.begin();
-    while(iter != glyphs.end()){
-        auto &glyph = iter->second;
-        if(glyph.context == ctxt){
-            iter = glyphs.erase(iter);
+Glyph *GlyphCache::insert(const FontParams &param){
+    //Keep load factor under 0.5
+    if((count + 1) * 2 > slots.size()){
+        rehash(slots.empty() ? 64 : slots.size() * 2);
+    }
+    uint32_t index;
+    if(!free_list.empty()){
+        index = free_list.back();
+        free_list.pop_back();
+        storage[index] = Glyph();
+    }
+    else{
+        index = storage.size();
+        storage.emplace_back();
+    }
+    Glyph &glyph = storage[index];
+    static_cast<FontParams&>(glyph) = param;
+
+    place(hash_of(param),index + 1);
+    count++;
+    return &glyph;
+}
+void   GlyphCache::erase(Glyph *glyph){
+    if(count == 0){
+        return;
+    }
+    uint32_t hash = hash_of(*glyph);
+    size_t   mask = slots.size() - 1;
+    size_t   pos  = hash & mask;
+    while(slots[pos].index != 0){
+        if(&storage[slots[pos].index - 1] == glyph){
+            break;
         }
-        else{
-            ++iter;
+        pos = (pos + 1) & mask;
+    }
+    if(slots[pos].index == 0){
+        //Not in table
+        return;
+    }
+    free_list.push_back(slots[pos].index - 1);
+    glyph->face = Ref<Face>();//< Don't keep the face alive
+    slots[pos].index = 0;
+    count--;
+    //Backward shift deletion,keep probe chains without tombstones
+    size_t hole = pos;
+    size_t next = (pos + 1) & mask;
+    while(slots[next].index != 0){
+        size_t home = slots[next].hash & mask;
+        //Move it if the hole is in [home,next) cyclically
+        if(((next - home) & mask) >= ((next - hole) & mask)){
+            slots[hole] = slots[next];
+            slots[next].index = 0;
+            hole = next;
         }
+        next = (next + 1) & mask;
     }
 }
+void   GlyphCache::clear(){
+    slots.clear();
+    storage.clear();
+    free_list.clear();
+    count = 0;
+}
 
 Fontstash::Fontstash(Manager &m){
     _manager = &m;
@@ -239,6 +752,13 @@ Fontstash::~Fontstash(){
 }
 
 int   Fontstash::add_font(Ref<Face> face){
+    #if FONS_CLEARTYPE
+    face->set_flags(
+        FT_LOAD_TARGET_LCD 
+    );
+    #endif
+
+    std::lock_guard<std::mutex> lock(mutex);
     int id;
     do{
         id = std::rand();
@@ -251,17 +771,12 @@ int   Fontstash::add_font(Ref<Face> face){
     f->stash = this;
     f->face = face;
     f->id = id;
+    f->has_kerning = face->has_kerning();
     fonts[id] = f;
-
-    #if FONS_CLEARTYPE
-    face->set_flags(
-        FT_LOAD_TARGET_LCD 
-    );
-    #endif
-
     return id;
 }
 Font *Fontstash::get_font(int id){
+    std::lock_guard<std::mutex> lock(mutex);
     auto it = fonts.find(id);
     if(it == fonts.end()){
         return nullptr;
@@ -269,6 +784,7 @@ Font *Fontstash::get_font(int id){
     return it->second.get();
 }
 Font *Fontstash::get_font(const char *name){
+    std::lock_guard<std::mutex> lock(mutex);
     for(auto &it : fonts){
         if(it.second->name == name){
             return it.second.get();
@@ -277,88 +793,777 @@ Font *Fontstash::get_font(const char *name){
     return nullptr;
 }
 void  Fontstash::remove_font(int id){
-    fonts.erase(id);
+    Ref<Font> font;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = fonts.find(id);
+        if(it == fonts.end()){
+            return;
+        }
+        font = std::move(it->second);
+        fonts.erase(it);
+        //Contexts release the shards of it,the face may be resolved as fallback
+        serial++;
+    }
+}
+
+//Worker threads for rasterizing glyphs,the calling thread is worker 0
+struct Context::RasterPool {
+    RasterPool(int n);
+    ~RasterPool();
+    /**
+     * @brief Call fn(worker,i) for i in [0,count) by all workers,return after all done
+     * 
+     * @param count 
+     * @param fn 
+     */
+    void  run(size_t count,const std::function<void(int,size_t)> &fn);
+    /**
+     * @brief Make sure every worker has a clone of the face(called before run)
+     * 
+     * @param face 
+     */
+    void  prepare(Face *face);
+    /**
+     * @brief Get the face used by the worker(worker 0 uses the face itself)
+     * 
+     * @param worker 
+     * @param face 
+     * @return Face* 
+     */
+    Face *face_of(int worker,Face *face);
+    void  work(int worker);
+    void  loop(int worker);
+
+    std::vector<std::thread> threads;
+    std::vector<std::unordered_map<Face*,Ref<Face>>> faces;//< Clones of each worker
+    std::mutex              mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void(int,size_t)> *job = nullptr;
+    size_t                  count = 0;
+    std::atomic<size_t>     next{0};
+    int                     busy = 0;//< Workers not finished the job
+    uint32_t                serial = 0;//< Changed on each job
+    bool                    quit = false;
+};
+Context::RasterPool::RasterPool(int n){
+    faces.resize(n);
+    for(int i = 1;i < n;i++){
+        threads.emplace_back(&RasterPool::loop,this,i);
+    }
+}
+Context::RasterPool::~RasterPool(){
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    wake.notify_all();
+    for(auto &t : threads){
+        t.join();
+    }
+    //Clones are released by the map
+}
+void  Context::RasterPool::run(size_t n,const std::function<void(int,size_t)> &fn){
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job   = &fn;
+        count = n;
+        next  = 0;
+        busy  = int(threads.size());
+        serial++;
+    }
+    wake.notify_all();
+    work(0);
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock,[this](){
+        return busy == 0;
+    });
+    job = nullptr;
+}
+void  Context::RasterPool::prepare(Face *face){
+    for(size_t i = 1;i < faces.size();i++){
+        auto &clone = faces[i][face];
+        if(clone.empty()){
+            clone = face->clone();
+        }
+    }
+}
+Face *Context::RasterPool::face_of(int worker,Face *face){
+    if(worker == 0){
+        return face;
+    }
+    return faces[worker].find(face)->second.get();
+}
+void  Context::RasterPool::work(int worker){
+    size_t i;
+    while((i = next.fetch_add(1)) < count){
+        (*job)(worker,i);
+    }
+}
+void  Context::RasterPool::loop(int worker){
+    uint32_t seen = 0;
+    while(true){
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock,[&](){
+            return quit || serial != seen;
+        });
+        if(quit){
+            return;
+        }
+        seen = serial;
+        lock.unlock();
+        work(worker);
+        lock.lock();
+        if(--busy == 0){
+            done.notify_one();
+        }
+    }
+}
+
+//Background thread rasterizing the missing glyphs in async mode
+struct Context::AsyncLoader {
+    struct Job {
+        Glyph              glyph;//< Copy of the glyph,the face is a clone
+        uint32_t           ticket;
+        uint32_t           resets;//< The reset_serial of the context when queued
+        std::vector<Pixel> bitmap;//< Rasterized by the thread
+    };
+    AsyncLoader();
+    ~AsyncLoader();
+    void  loop();
+
+    std::thread             thread;
+    std::unordered_map<Face*,Ref<Face>> faces;//< Clones for the thread(only touched by the context)
+    std::mutex              mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::deque<Job>         jobs;
+    std::vector<Job>        results;
+    std::atomic<uint32_t>   resolved{0};//< The last ticket all rasterized
+    uint32_t                ticket = 0;//< The last ticket queued
+    uint32_t                polled = 0;//< The last ticket copied into atlas
+    bool                    quit = false;
+};
+Context::AsyncLoader::AsyncLoader(){
+    thread = std::thread(&AsyncLoader::loop,this);
+}
+Context::AsyncLoader::~AsyncLoader(){
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    wake.notify_all();
+    thread.join();
+}
+void  Context::AsyncLoader::loop(){
+    std::unique_lock<std::mutex> lock(mutex);
+    while(true){
+        wake.wait(lock,[this](){
+            return quit || !jobs.empty();
+        });
+        if(quit){
+            return;
+        }
+        Job job = std::move(jobs.front());
+        jobs.pop_front();
+        lock.unlock();
+        auto &g = job.glyph;
+        job.bitmap.assign(size_t(g.width) * g.height,Pixel(0));
+        RasterGlyph(&g,g.face.get(),job.bitmap.data(),g.width);
+        g.face = Ref<Face>();
+        lock.lock();
+        uint32_t t = job.ticket;
+        results.push_back(std::move(job));
+        if(jobs.empty() || jobs.front().ticket != t){
+            //Tickets are queued in order,so all before it are done
+            resolved.store(t,std::memory_order_release);
+            done.notify_all();
+        }
+    }
 }
 
 //Context operations
-Context::Context(Fontstash &m,int w,int h):atlas(m.manager(),w,h){
+Context::Context(Fontstash &m,int w,int h){
     stash = &m;
     bitmap_w = w;
     bitmap_h = h;
-    bitmap.resize(bitmap_w * bitmap_h);
+    //Init first page
+    pages.emplace_back(new Page(m.manager(),w,h));
 
     //Push one state
     push_state();
 
-    //Init dirty
-    dirty_rect[0] = w;
-    dirty_rect[1] = h;
-    dirty_rect[2] = 0;
-    dirty_rect[3] = 0;
-
     //Init Error handler
     handler = nullptr;
     user    = nullptr;
 }
-Context::~Context(){
-    for(auto &f:fonts){
-        f->clear_cache_of(this);
+Context::~Context(){
+    //Clones in workers first
+    pool.reset();
+    loader.reset();
+    release_shards();
+}
+void Context::set_raster_threads(int n){
+    if(n <= 1){
+        pool.reset();
+        return;
+    }
+    if(pool != nullptr && int(pool->faces.size()) == n){
+        return;
+    }
+    pool.reset(new RasterPool(n));
+}
+void Context::set_async(bool enable){
+    if(!enable){
+        if(loader != nullptr){
+            wait_glyphs();
+            loader.reset();
+        }
+        return;
+    }
+    if(loader == nullptr){
+        loader.reset(new AsyncLoader);
+    }
+}
+uint32_t Context::poll_glyphs(){
+    if(loader == nullptr){
+        return 0;
+    }
+    if(loader->resolved.load(std::memory_order_acquire) == loader->polled){
+        //Nothing landed
+        return loader->polled;
+    }
+    std::vector<AsyncLoader::Job> results;
+    {
+        std::lock_guard<std::mutex> lock(loader->mutex);
+        results.swap(loader->results);
+        loader->polled = loader->resolved;
+    }
+    //Glyphs may be evicted or removed since queued,find them again by key
+    std::vector<Glyph*> landed;
+    for(auto &job : results){
+        if(job.resets != reset_serial){
+            //Queued before the atlas reset,the rect is gone
+            continue;
+        }
+        Glyph *g = nullptr;
+        for(auto &it : shards){
+            g = it.second->glyphs.find(job.glyph);
+            if(g != nullptr && g->ticket == job.ticket){
+                break;
+            }
+            g = nullptr;
+        }
+        if(g == nullptr){
+            continue;
+        }
+        Pixel *dst = pages[g->page]->bitmap.data() + g->y * bitmap_w + g->x;
+        for(int row = 0;row < g->height;row++){
+            std::copy_n(job.bitmap.data() + row * g->width,g->width,dst + row * bitmap_w);
+        }
+        g->ticket = 0;
+        landed.push_back(g);
+    }
+    mark_dirty(landed);
+    return loader->polled;
+}
+int  Context::prewarm(const CodepointRange *ranges,size_t nranges,const float *sizes,size_t nsizes){
+    Font *font = font_of(states.top().font);
+    if(font == nullptr){
+        return 0;
+    }
+    if(loader != nullptr){
+        poll_glyphs();
+    }
+    auto &state = states.top();
+    auto &cache = shard_of(font)->glyphs;
+    //Metrics first,the rects are reserved after sorting
+    std::vector<Glyph*> glyphs;
+    bool full = false;
+    for(size_t n = 0;n < nsizes && !full;n++){
+        short size = state.sdf ? FONS_SDF_SIZE : short(sizes[n]);
+        int   levels = (state.subpixel && !state.sdf && size <= FONS_SUBPIXEL_MAX_SIZE) ? FONS_SUBPIXEL_LEVELS : 1;
+        for(size_t r = 0;r < nranges && !full;r++){
+            for(char32_t c = ranges[r].first;c <= ranges[r].last && !full;c++){
+                for(int sub = 0;sub < levels;sub++){
+                    FontParams param;
+                    param.context = this;
+                    param.codepoint = c;
+                    param.size = size;
+                    param.blur = state.sdf ? 0 : state.blur;
+                    param.flags = state.sdf ? FONS_GLYPH_SDF : 0;
+                    param.subpixel = sub;
+                    size_t cached = cache.size();
+                    Glyph *g = font->get_glyph(param,FONS_GLYPH_BITMAP_OPTIONAL);
+                    if(cache.size() > FONS_MAX_CACHED_GLYPHS){
+                        //All cached glyphs are used in this frame,nothing left to evict
+                        FONS_LOG("Glyph cache full in prewarm");
+                        if(cache.size() > cached){
+                            cache.erase(g);
+                        }
+                        full = true;
+                        break;
+                    }
+                    //Missing codepoint would be the notdef glyph
+                    if(g != nullptr && g->x < 0 && g->index != 0){
+                        glyphs.push_back(g);
+                    }
+                }
+                if(c == ranges[r].last){
+                    break;
+                }
+            }
+        }
+        if(state.sdf){
+            //One size for all
+            break;
+        }
+    }
+    std::sort(glyphs.begin(),glyphs.end());
+    glyphs.erase(std::unique(glyphs.begin(),glyphs.end()),glyphs.end());
+    //Tallest first,better for skyline
+    std::sort(glyphs.begin(),glyphs.end(),[](const Glyph *a,const Glyph *b){
+        if(a->height != b->height){
+            return a->height > b->height;
+        }
+        return a->width > b->width;
+    });
+    int count = 0;
+    uint32_t resets = reset_serial;
+    for(Glyph *g : glyphs){
+        int x,y,page;
+        int w = g->width;
+        int h = g->height;
+        if(!alloc_rect(w,h,&page,&x,&y)){
+            FONS_LOG("Atlas full in prewarm");
+            break;
+        }
+        if(reset_serial != resets){
+            //Atlas reset by the handler,the glyphs are gone with the cache
+            pages[page]->atlas.free_rect(x,y,w,h);
+            count = 0;
+            break;
+        }
+        g->x = x;
+        g->y = y;
+        g->page = page;
+        pending.push_back(g);
+        count++;
+    }
+    raster_pending();
+    return count;
+}
+uint32_t Context::wait_glyphs(){
+    if(loader == nullptr){
+        return 0;
+    }
+    {
+        std::unique_lock<std::mutex> lock(loader->mutex);
+        loader->done.wait(lock,[this](){
+            return loader->resolved == loader->ticket;
+        });
+    }
+    return poll_glyphs();
+}
+void Context::raster_glyph(Glyph *g,Face *face){
+    Pixel *dst = pages[g->page]->bitmap.data() + g->y * bitmap_w + g->x;
+    RasterGlyph(g,face,dst,bitmap_w);
+}
+uint32_t Context::raster_pending(){
+    if(pending.empty()){
+        return 0;
+    }
+    if(loader != nullptr){
+        //Copy them for the thread,poll_glyphs puts the bitmaps back
+        std::vector<AsyncLoader::Job> jobs(pending.size());
+        for(size_t i = 0;i < pending.size();i++){
+            Glyph *g = pending[i];
+            auto &clone = loader->faces[g->face.get()];
+            if(clone.empty()){
+                clone = g->face->clone();
+            }
+            jobs[i].glyph = *g;
+            jobs[i].glyph.face = clone;
+            jobs[i].resets = reset_serial;
+        }
+        uint32_t ticket;
+        {
+            std::lock_guard<std::mutex> lock(loader->mutex);
+            ticket = ++loader->ticket;
+            for(auto &job : jobs){
+                job.ticket = ticket;
+                loader->jobs.push_back(std::move(job));
+            }
+        }
+        loader->wake.notify_one();
+        for(Glyph *g : pending){
+            g->ticket = ticket;
+        }
+        pending.clear();
+        return ticket;
+    }
+    if(pool != nullptr && pending.size() >= FONS_RASTER_BATCH_MIN){
+        //Faces are cloned here,workers only look them up
+        for(Glyph *g : pending){
+            pool->prepare(g->face.get());
+        }
+        pool->run(pending.size(),[this](int worker,size_t i){
+            Glyph *g = pending[i];
+            raster_glyph(g,pool->face_of(worker,g->face.get()));
+        });
+    }
+    else{
+        for(Glyph *g : pending){
+            raster_glyph(g,g->face.get());
+        }
+    }
+    mark_dirty(pending);
+    pending.clear();
+    return 0;
+}
+void Context::mark_dirty(const std::vector<Glyph*> &glyphs){
+    if(glyphs.empty()){
+        return;
+    }
+    //Merge the dirty rect of each page
+    std::vector<int> rects(pages.size() * 4);
+    for(size_t n = 0;n < pages.size();n++){
+        rects[n * 4 + 0] = INT_MAX;
+        rects[n * 4 + 1] = INT_MAX;
+        rects[n * 4 + 2] = INT_MIN;
+        rects[n * 4 + 3] = INT_MIN;
+    }
+    for(Glyph *g : glyphs){
+        int *r = &rects[g->page * 4];
+        r[0] = std::min(r[0],g->x);
+        r[1] = std::min(r[1],g->y);
+        r[2] = std::max(r[2],g->x + g->width);
+        r[3] = std::max(r[3],g->y + g->height);
+    }
+    for(size_t n = 0;n < pages.size();n++){
+        int *r = &rects[n * 4];
+        if(r[0] != INT_MAX){
+            pages[n]->mark_dirty(r[0],r[1],r[2] - r[0],r[3] - r[1]);
+        }
+    }
+}
+Glyph *Context::placeholder_glyph(){
+    if(last_shard == nullptr){
+        return nullptr;
+    }
+    //Keep it in the glyph cache,so it is moved by compaction and removed by reset like others
+    FontParams key;
+    key.context = this;
+    key.codepoint = char32_t(~0);
+    key.blur = 0;
+    key.size = 0;
+    key.flags = 0;
+    key.subpixel = 0;
+    auto &glyphs = last_shard->glyphs;
+    Glyph *g = glyphs.find(key);
+    if(g == nullptr){
+        //3x3 solid,the center texel is sampled
+        g = glyphs.insert(key);
+        static_cast<GlyphMetrics&>(*g) = {3,3,0,0,0,0};
+    }
+    g->generation = generation;
+    if(g->x < 0 || g->y < 0){
+        int x,y,page;
+        int w = g->width;
+        int h = g->height;
+        uint32_t resets = reset_serial;
+        if(!alloc_rect(w,h,&page,&x,&y)){
+            return nullptr;
+        }
+        if(reset_serial != resets){
+            //The handler reset the atlas,the glyph is gone
+            pages[page]->atlas.free_rect(x,y,w,h);
+            return nullptr;
+        }
+        g->x = x;
+        g->y = y;
+        g->page = page;
+#if FONS_CLEARTYPE
+        uint32_t v = FONS_PLACEHOLDER_COVERAGE;
+        Pixel pixel = (v << 24) | (v << 16) | (v << 8);
+#else
+        Pixel pixel = FONS_PLACEHOLDER_COVERAGE;
+#endif
+        Pixel *dst = pages[page]->bitmap.data() + y * bitmap_w + x;
+        for(int row = 0;row < g->height;row++){
+            std::fill_n(dst + row * bitmap_w,g->width,pixel);
+        }
+        pages[page]->mark_dirty(x,y,g->width,g->height);
+    }
+    return g;
+}
+Font *Context::font_of(int id){
+    if(font_serial != stash->serial){
+        //Fonts removed or fallbacks changed
+        std::vector<std::unique_ptr<Font::Shard>> removed;
+        {
+            std::lock_guard<std::mutex> lock(stash->mutex);
+            font_serial = stash->serial;
+            for(auto it = shards.begin();it != shards.end();){
+                auto &s = it->second;
+                s->resolved.clear();
+                auto f = stash->fonts.find(it->first);
+                if(f == stash->fonts.end() || f->second.get() != s->font.get()){
+                    removed.emplace_back(std::move(s));
+                    it = shards.erase(it);
+                    continue;
+                }
+                ++it;
+            }
+        }
+        last_shard = nullptr;
+        if(!removed.empty()){
+            //Drop glyphs of the removed faces(fallback glyphs may be in other shards),give the space back to atlas
+            std::set<Face*> faces;
+            for(auto &s : removed){
+                faces.insert(s->face.get());
+            }
+            auto drop = [&](Glyph &g){
+                if(faces.count(g.face.get()) == 0){
+                    return false;
+                }
+                if(g.x >= 0 && g.y >= 0){
+                    pages[g.page]->atlas.free_rect(g.x,g.y,g.width,g.height);
+                }
+                return true;
+            };
+            for(auto &s : removed){
+                s->glyphs.erase_if(drop);
+            }
+            for(auto &it : shards){
+                it.second->glyphs.erase_if(drop);
+            }
+            run_serial++;
+            atlas_epoch++;
+        }
+        //Faces are released in lock
+        std::lock_guard<std::mutex> lock(stash->mutex);
+        for(auto &s : removed){
+            s->font->release(s.get());
+            s.reset();
+        }
+        if(pool != nullptr && !removed.empty()){
+            //The faces may be destroyed,drop the clones
+            for(auto &clones : pool->faces){
+                clones.clear();
+            }
+        }
+        if(loader != nullptr && !removed.empty()){
+            //Queued jobs hold their clones
+            loader->faces.clear();
+        }
+    }
+    if(last_shard != nullptr && last_shard->font->get_id() == id){
+        return last_shard->font.get();
+    }
+    auto it = shards.find(id);
+    if(it != shards.end()){
+        last_shard = it->second.get();
+        return last_shard->font.get();
+    }
+    Font *font = stash->get_font(id);
+    if(font == nullptr){
+        return nullptr;
+    }
+    return shard_of(font)->font.get();
+}
+Font::Shard *Context::shard_of(Font *font){
+    if(last_shard != nullptr && last_shard->font.get() == font){
+        return last_shard;
+    }
+    auto it = shards.find(font->get_id());
+    if(it != shards.end() && it->second->font.get() == font){
+        last_shard = it->second.get();
+        return last_shard;
+    }
+    //First use in this context,use the face if no one is using it
+    std::unique_ptr<Font::Shard> s(new Font::Shard);
+    s->context = this;
+    s->font = font;
+    {
+        std::lock_guard<std::mutex> lock(stash->mutex);
+        if(!font->face_taken){
+            s->face = font->face;
+            font->face_taken = true;
+        }
+        else{
+            s->face = font->face->clone();
+        }
+        font->shards.push_back(s.get());
+    }
+    last_shard = s.get();
+    shards[font->get_id()] = std::move(s);
+    return last_shard;
+}
+void Context::release_shards(){
+    std::lock_guard<std::mutex> lock(stash->mutex);
+    for(auto &it : shards){
+        auto &s = it.second;
+        s->font->release(s.get());
+        s.reset();
     }
+    shards.clear();
+    last_shard = nullptr;
 }
 
 Size Context::measure_text(const char *str,const char *end){
-    Font *font = stash->get_font(states.top().font);
-    if(font == nullptr){
+    if(!layout_text(str,end,FONS_GLYPH_BITMAP_OPTIONAL,run)){
         return {0,0};
     }
+    return run.size;
+}
+bool Context::layout_text(const char *str,const char *end,int bitmapOption,TextRun &run){
+    //The handler may reset the atlas while adding glyphs,the glyphs before are gone then,lay out again
+    for(int tries = 0;tries < 2;tries++){
+        uint32_t resets = reset_serial;
+        if(!layout_once(str,end,bitmapOption,run)){
+            return false;
+        }
+        if(reset_serial == resets){
+            return true;
+        }
+    }
+    //The string doesn't fit,keep the glyphs added after the last reset
+    FONS_LOG("Atlas reset again while laying out,%zu glyphs kept",run.glyphs.size());
+    return true;
+}
+bool Context::layout_once(const char *str,const char *end,int bitmapOption,TextRun &run){
+    run.clear();
+    Font *font = font_of(states.top().font);
+    if(font == nullptr){
+        return false;
+    }
+    if(loader != nullptr){
+        //Glyphs landed may be used by this run
+        poll_glyphs();
+    }
     if(end == nullptr){
         end = str + std::strlen(str);
     }
+    auto &state = states.top();
+    auto m = font->metrics_of(this,state.size);
+    run.metrics = m;
+    //SDF glyphs are cached at one size and scaled
+    short glyph_size = state.size;
+    short flags = 0;
+    float scale = 1;
+    int   pad = 0;//< Padding of bitmap,not counted in size
+    if(state.sdf){
+        glyph_size = FONS_SDF_SIZE;
+        flags = FONS_GLYPH_SDF;
+        scale = state.size / FONS_SDF_SIZE;
+        pad = LILIM_SDF_SPREAD;
+    }
+    run.scale = scale;
+    //Pen fraction selects the bitmap,the origin is snapped by caller
+    bool subpixel = state.subpixel && !state.sdf && glyph_size <= FONS_SUBPIXEL_MAX_SIZE;
+    run.subpixel = subpixel;
+    //Missing bitmaps are rasterized together at the end(or in background)
+    int option = bitmapOption;
+    if(option == FONS_GLYPH_BITMAP_REQUIRED && (pool != nullptr || loader != nullptr)){
+        option = FONS_GLYPH_BITMAP_DEFERRED;
+    }
+    uint32_t ticket = 0;
+    //Width is accumulated as int like before,pen in float
     Size size = {0,0};
-    auto m = font->metrics_of(states.top().size);
+    float pen = 0;
     //Using UINT_MAX as no codepoint
     //0 means empty glyph
     bool first = true;
     Uint prev = UINT_MAX;
 
+    char32_t buffer[LILIM_DECODE_CHUNK];
+    uint32_t resets = reset_serial;
+    run.start = str;
+    run.stop = end;
     while(str < end){
-        char32_t c = Utf8Decode(str);
-        FontParams param;
-        param.context = this;
-        param.codepoint = c;
-        param.size = states.top().size;
-        param.blur = states.top().blur;
-        //Kerning / Spacing
-        if(!first){
-            size.width += font->kerning(param.size,prev,c);
-            size.width += states.top().spacing;
-        }
-        else{
-            first = false;
-        }
-        prev = c;
+        const char *cur = str;
+        size_t n = Utf8Decode(str,end,buffer,LILIM_DECODE_CHUNK);
+        //One byte for each char in ASCII,or find the starts again
+        bool ascii = size_t(str - cur) == n;
+        for(size_t i = 0;i < n;i++){
+            char32_t c = buffer[i];
+            const char *at = cur;
+            if(ascii){
+                cur++;
+            }
+            else{
+                char32_t tmp;
+                Utf8Decode(cur,end,&tmp,1);
+            }
+            FontParams param;
+            param.context = this;
+            param.codepoint = c;
+            param.size = glyph_size;
+            param.blur = state.sdf ? 0 : state.blur;
+            param.flags = flags;
+            param.subpixel = 0;
+            //Kerning / Spacing
+            if(!first){
+                float kerning = font->kerning(this,param.size,prev,c) * scale;
+                size.width += kerning;
+                size.width += state.spacing;
+                pen += kerning;
+                pen += state.spacing;
+            }
+            else{
+                first = false;
+            }
+            prev = c;
+            if(subpixel){
+                param.subpixel = short((pen - std::floor(pen)) * FONS_SUBPIXEL_LEVELS);
+            }
 
-        //Send to fond
-        Glyph *g = font->get_glyph(param,FONS_GLYPH_BITMAP_OPTIONAL);
-        if(g == nullptr){
-            //No Glyph?
-            break;
-        }
-        int yoffset = m.ascender - g->bitmap_top;
+            //Send to fond
+            Glyph *g = font->get_glyph(param,option);
+            if(g == nullptr){
+                //No Glyph?,stopped here
+                run.stop = at;
+                run.size = size;
+                if(subpixel){
+                    run.size.width = std::ceil(pen);
+                }
+                run.ticket = std::max(ticket,raster_pending());
+                return true;
+            }
+            if(reset_serial != resets){
+                //Atlas reset by the handler,the glyphs before are gone(the pen and size are kept)
+                run.glyphs.clear();
+                ticket = 0;
+                resets = reset_serial;
+            }
+            ticket = std::max(ticket,g->ticket);
+            int yoffset = m.ascender - (g->bitmap_top - pad) * scale;
+            int height  = std::ceil((g->height - pad * 2) * scale);
+
+            size.height = std::max(size.height,height);
+            size.height = std::max(size.height,height + yoffset);
+            size.width += g->advance_x * scale;
 
-        size.height = std::max(size.height,g->height);
-        size.height = std::max(size.height,g->height + yoffset);
-        size.width += g->advance_x;
+            run.glyphs.push_back({g,pen,uint32_t(at - run.start)});
+            pen += subpixel ? g->advance_x64 / 64.0f : g->advance_x * scale;
+        }
+    }
+    run.size = size;
+    if(subpixel){
+        run.size.width = std::ceil(pen);
     }
-    return size;
+    run.ticket = std::max(ticket,raster_pending());
+    return true;
 }
 
 void Context::vert_metrics(float* ascender, float* descender, float* lineh){
-    Font *font = stash->get_font(states.top().font);
+    Font *font = font_of(states.top().font);
     if(font == nullptr){
         return;
     }
-    auto m = font->metrics_of(states.top().size);
+    auto m = font->metrics_of(this,states.top().size);
     
     if(ascender != nullptr){
         *ascender = m.ascender;
@@ -371,11 +1576,11 @@ void Context::vert_metrics(float* ascender, float* descender, float* lineh){
     }
 }
 void Context::line_bounds(float y, float* miny, float* maxy){
-    Font *font = stash->get_font(states.top().font);
+    Font *font = font_of(states.top().font);
     if(font == nullptr){
         return;
     }
-    auto m = font->metrics_of(states.top().size);
+    auto m = font->metrics_of(this,states.top().size);
     //Align To Top
     //Dst()-------
     //|
@@ -405,8 +1610,8 @@ float Context::text_bounds(float x, float y, const char* str, const char* end, f
     if(end == nullptr){
         end = str + strlen(str);
     }
-    Font *font = stash->get_font(states.top().font);
-    auto metrics = font->metrics_of(states.top().size);
+    Font *font = font_of(states.top().font);
+    auto metrics = font->metrics_of(this,states.top().size);
     auto align = states.top().align;
 
     auto size = measure_text(str,end);
@@ -425,17 +1630,15 @@ float Context::text_bounds(float x, float y, const char* str, const char* end, f
     //Return width
     return width;
 }
-bool Context::validate(int *dirty){
-    if (dirty_rect[0] < dirty_rect[2] && dirty_rect[1] < dirty_rect[3]) {
-        dirty[0] = dirty_rect[0];
-        dirty[1] = dirty_rect[1];
-        dirty[2] = dirty_rect[2];
-        dirty[3] = dirty_rect[3];
+bool Context::validate(int page,int *dirty){
+    auto &p = *pages[page];
+    if (p.has_dirty()) {
+        dirty[0] = p.dirty_rect[0];
+        dirty[1] = p.dirty_rect[1];
+        dirty[2] = p.dirty_rect[2];
+        dirty[3] = p.dirty_rect[3];
         // Reset dirty rect
-        dirty_rect[0] = bitmap_w;
-        dirty_rect[1] = bitmap_h;
-        dirty_rect[2] = 0;
-        dirty_rect[3] = 0;
+        p.clear_dirty();
         return 1;
     }
     return 0;
@@ -467,12 +1670,7 @@ void Context::dump_info(FILE *fp){
         return;
     }
     fprintf(fp,"Context at %p\n",this);
-    fprintf(fp,"    width %d height %d\n",bitmap_w,bitmap_h);
-    fprintf(fp,"    Dirty in:\n");
-    fprintf(fp,"        minx [%d]\n",dirty_rect[0]);
-    fprintf(fp,"        miny [%d]\n",dirty_rect[1]);
-    fprintf(fp,"        maxx [%d]\n",dirty_rect[2]);
-    fprintf(fp,"        maxy [%d]\n",dirty_rect[3]);
+    fprintf(fp,"    width %d height %d pages %d\n",bitmap_w,bitmap_h,int(pages.size()));
     fprintf(fp,"    Fonts:\n");
     for(auto &f : fonts){
         fprintf(fp,"        id %d => %p\n",f.get()->get_id(),f.get());
@@ -481,28 +1679,33 @@ void Context::dump_info(FILE *fp){
     fprintf(fp,"        font => %d\n",states.top().font);
     fprintf(fp,"        size => %f\n",states.top().size);
     fprintf(fp,"        blur => %d\n",states.top().blur);
+    fprintf(fp,"        sdf => %d\n",int(states.top().sdf));
     fprintf(fp,"        align => %d\n",states.top().align);
     fprintf(fp,"        spacing => %f\n",states.top().spacing);
-    //If has dirty rect dump it
-    if(dirty_rect[0] < dirty_rect[2] && dirty_rect[1] < dirty_rect[3]){
-        fprintf(fp,"    Dirty in:\n");
-        fprintf(fp,"        minx [%d]\n",dirty_rect[0]);
-        fprintf(fp,"        miny [%d]\n",dirty_rect[1]);
-        fprintf(fp,"        maxx [%d]\n",dirty_rect[2]);
-        fprintf(fp,"        maxy [%d]\n",dirty_rect[3]);
-        //Print texture data in dirty rect
-        fprintf(fp,"    Texture data:\n");
-        for(int y = dirty_rect[1]; y < dirty_rect[3]; y++){
-            fprintf(fp,"        ");
-            for(int x = dirty_rect[0]; x < dirty_rect[2]; x++){
-                fprintf(fp,"%c",bitmap[y * bitmap_w + x] ? '#' : ' ');
+    for(size_t n = 0;n < pages.size();n++){
+        auto &p = *pages[n];
+        fprintf(fp,"    Page %d:\n",int(n));
+        //If has dirty rect dump it
+        if(p.has_dirty()){
+            fprintf(fp,"    Dirty in:\n");
+            fprintf(fp,"        minx [%d]\n",p.dirty_rect[0]);
+            fprintf(fp,"        miny [%d]\n",p.dirty_rect[1]);
+            fprintf(fp,"        maxx [%d]\n",p.dirty_rect[2]);
+            fprintf(fp,"        maxy [%d]\n",p.dirty_rect[3]);
+            //Print texture data in dirty rect
+            fprintf(fp,"    Texture data:\n");
+            for(int y = p.dirty_rect[1]; y < p.dirty_rect[3]; y++){
+                fprintf(fp,"        ");
+                for(int x = p.dirty_rect[0]; x < p.dirty_rect[2]; x++){
+                    fprintf(fp,"%c",p.bitmap[y * bitmap_w + x] ? '#' : ' ');
+                }
+                fprintf(fp,"\n");
             }
-            fprintf(fp,"\n");
         }
-    }
-    else{
-        //Dirty rect is empty
-        fprintf(fp,"    DirtyRect empty:\n");
+        else{
+            //Dirty rect is empty
+            fprintf(fp,"    DirtyRect empty:\n");
+        }
     }
     #endif
 }
@@ -514,12 +1717,395 @@ bool Context::handle_atlas_full(){
     }
     return handler(user,FONS_ATLAS_FULL,0);
 }
+bool Context::alloc_rect(int w,int h,int *page,int *x,int *y){
+    //Give the handler a few chances(compact,add page,expand...)
+    for(int tries = 0;tries < 3;tries++){
+        for(size_t n = 0;n < pages.size();n++){
+            if(pages[n]->atlas.add_rect(w,h,x,y)){
+                if(tries != 0){
+                    //Sloved
+                    FONS_LOG("Success to slove atlas full");
+                }
+                *page = int(n);
+                return true;
+            }
+        }
+        //Atlas full,try to slove it
+        if(!handle_atlas_full()){
+            return false;
+        }
+    }
+    return false;
+}
+int  Context::free_area() const{
+    int area = 0;
+    for(auto &p : pages){
+        area += p->atlas.free_area();
+    }
+    return area;
+}
+//Atlas cache file,all in native byte order(the magic mismatches on others)
+constexpr uint32_t cache_magic   = 0x534E4F46;//< "FONS"
+constexpr uint32_t cache_version = 1;
+
+//The font of a cached glyph
+struct CacheFace {
+    uint64_t hash;//< FNV-1a of the font file
+    uint64_t size;
+    uint32_t index;
+    uint32_t flags;
+    uint32_t style;
+    uint32_t xdpi;
+    uint32_t ydpi;
+};
+//A cached glyph,the faces are indices of the face table
+struct CacheGlyph {
+    uint32_t owner;//< The font caching it
+    uint32_t face; //< The resolved font(self or fallback)
+    uint32_t codepoint;
+    int16_t  blur;
+    int16_t  size;
+    int16_t  flags;
+    int16_t  subpixel;
+    int32_t  metrics[6];
+    int32_t  x;
+    int32_t  y;
+    int32_t  page;
+    uint32_t index;
+};
+//Bounds checked reader of the mapped file
+struct CacheReader {
+    const uint8_t *cur;
+    const uint8_t *end;
+    bool           ok = true;
+
+    const uint8_t *take(size_t n){
+        if(!ok || size_t(end - cur) < n){
+            ok = false;
+            return nullptr;
+        }
+        const uint8_t *p = cur;
+        cur += n;
+        return p;
+    }
+    template<class T>
+    T get(){
+        T value = {};
+        if(auto p = take(sizeof(T))){
+            std::memcpy(&value,p,sizeof(T));
+        }
+        return value;
+    }
+};
+template<class T>
+static void CachePut(std::vector<uint8_t> &out,const T &value){
+    auto p = reinterpret_cast<const uint8_t*>(&value);
+    out.insert(out.end(),p,p + sizeof(T));
+}
+//Key of a face,the file hash is computed once for each blob
+static CacheFace CacheFaceOf(Face *face,std::unordered_map<Blob*,uint64_t> &hashes){
+    //Zeroed,the padding is written too
+    CacheFace key = {};
+    Blob *blob = face->data();
+    auto it = hashes.find(blob);
+    if(it == hashes.end()){
+        uint64_t hash = 14695981039346656037ULL;
+        auto bytes = blob->as<const uint8_t>();
+        for(size_t i = 0;i < blob->size();i++){
+            hash ^= bytes[i];
+            hash *= 1099511628211ULL;
+        }
+        it = hashes.emplace(blob,hash).first;
+    }
+    key.hash  = it->second;
+    key.size  = blob->size();
+    key.index = face->face_index();
+    key.flags = face->load_flags();
+    key.style = face->style_flags();
+    face->get_dpi(&key.xdpi,&key.ydpi);
+    return key;
+}
+//The glyph fits the values a context makes,and its bitmap(if any) a page
+static bool ValidCacheGlyph(const CacheGlyph &c,int w,int h,int n){
+    if(c.size <= 0 || c.size > FONS_MAX_FONT_SIZE || c.blur < 0 || c.blur > FONS_MAX_BLUR ||
+       c.subpixel < 0 || c.subpixel >= FONS_SUBPIXEL_LEVELS || c.metrics[0] < 0 || c.metrics[1] < 0){
+        return false;
+    }
+    if(c.x == -1 && c.y == -1){
+        //Metrics only
+        return true;
+    }
+    return c.page >= 0 && c.page < n && c.x >= 0 && c.y >= 0 &&
+           c.metrics[0] <= w - c.x && c.metrics[1] <= h - c.y;
+}
+static bool SameCacheFace(const CacheFace &a,const CacheFace &b){
+    return a.hash == b.hash && a.size == b.size && a.index == b.index &&
+           a.flags == b.flags && a.style == b.style &&
+           a.xdpi == b.xdpi && a.ydpi == b.ydpi;
+}
+
+bool Context::save_cache(const char *path){
+    //Bitmaps in background must be in atlas
+    wait_glyphs();
+    //Faces are keyed on the original face of their fonts(clones in contexts are the same)
+    std::unordered_map<Blob*,uint64_t> hashes;
+    std::unordered_map<Face*,uint32_t> ids;
+    std::vector<CacheFace> faces;
+    for(auto &it : shards){
+        auto &s = it.second;
+        ids[s->face.get()] = faces.size();
+        faces.push_back(CacheFaceOf(s->font->face.get(),hashes));
+    }
+    std::vector<CacheGlyph> glyphs;
+    for(auto &it : shards){
+        uint32_t owner = ids[it.second->face.get()];
+        it.second->glyphs.for_each([&](Glyph &g){
+            //Skip the placeholder and glyphs without bitmap yet
+            auto face = ids.find(g.face.get());
+            if(face == ids.end() || g.ticket != 0){
+                return;
+            }
+            CacheGlyph c = {};
+            c.owner = owner;
+            c.face = face->second;
+            c.codepoint = g.codepoint;
+            c.blur = g.blur;
+            c.size = g.size;
+            c.flags = g.flags;
+            c.subpixel = g.subpixel;
+            c.metrics[0] = g.width;
+            c.metrics[1] = g.height;
+            c.metrics[2] = g.bitmap_left;
+            c.metrics[3] = g.bitmap_top;
+            c.metrics[4] = g.advance_x;
+            c.metrics[5] = g.advance_x64;
+            c.x = g.x;
+            c.y = g.y;
+            c.page = g.page;
+            c.index = g.index;
+            glyphs.push_back(c);
+        });
+    }
+
+    std::vector<uint8_t> out;
+    CachePut(out,cache_magic);
+    CachePut(out,cache_version);
+    CachePut(out,uint32_t(sizeof(Pixel)));
+    CachePut(out,int32_t(bitmap_w));
+    CachePut(out,int32_t(bitmap_h));
+    CachePut(out,int32_t(pages.size()));
+    for(auto &p : pages){
+        auto &atlas = p->atlas;
+        CachePut(out,int32_t(atlas.nnodes));
+        for(int i = 0;i < atlas.nnodes;i++){
+            CachePut(out,atlas.nodes[i]);
+        }
+        CachePut(out,int32_t(atlas.free_rects.size()));
+        for(auto &rect : atlas.free_rects){
+            CachePut(out,rect);
+        }
+        auto bytes = reinterpret_cast<const uint8_t*>(p->bitmap.data());
+        out.insert(out.end(),bytes,bytes + p->bitmap.size() * sizeof(Pixel));
+    }
+    CachePut(out,uint32_t(faces.size()));
+    for(auto &face : faces){
+        CachePut(out,face);
+    }
+    CachePut(out,uint32_t(glyphs.size()));
+    for(auto &glyph : glyphs){
+        CachePut(out,glyph);
+    }
+
+    FILE *fp = std::fopen(path,"wb");
+    if(fp == nullptr){
+        return false;
+    }
+    bool ok = std::fwrite(out.data(),1,out.size(),fp) == out.size();
+    ok = (std::fclose(fp) == 0) && ok;
+    return ok;
+}
+bool Context::load_cache(const char *path){
+    Ref<Blob> blob = MapFile(path);
+    if(blob.empty()){
+        return false;
+    }
+    CacheReader r;
+    r.cur = blob->as<const uint8_t>();
+    r.end = r.cur + blob->size();
+    if(r.get<uint32_t>() != cache_magic || r.get<uint32_t>() != cache_version || r.get<uint32_t>() != sizeof(Pixel)){
+        FONS_LOG("Invalid atlas cache %s",path);
+        return false;
+    }
+    int w = r.get<int32_t>();
+    int h = r.get<int32_t>();
+    int n = r.get<int32_t>();
+    if(!r.ok || w <= 0 || h <= 0 || w > FONS_MAX_ATLAS_SIZE || h > FONS_MAX_ATLAS_SIZE || n <= 0 || n > FONS_MAX_ATLAS_PAGES){
+        FONS_LOG("Invalid atlas cache %s",path);
+        return false;
+    }
+    //Parse all first,so a broken file changes nothing
+    std::vector<std::unique_ptr<Page>> fresh;
+    const size_t page_bytes = size_t(w) * h * sizeof(Pixel);
+    for(int i = 0;i < n;i++){
+        //The pixels follow the rects,a short file is refused before allocating the page
+        if(size_t(r.end - r.cur) < page_bytes){
+            FONS_LOG("Broken atlas cache %s",path);
+            return false;
+        }
+        std::unique_ptr<Page> p(new Page(manager(),w,h));
+        auto &atlas = p->atlas;
+        int nnodes = r.get<int32_t>();
+        if(nnodes <= 0 || nnodes > w + 1){
+            return false;
+        }
+        //The skyline covers [0,w] from left to right
+        atlas.nnodes = 0;
+        int right = 0;
+        for(int k = 0;k < nnodes && r.ok;k++){
+            auto node = r.get<AtlasNode>();
+            if(node.x != right || node.width <= 0 || node.width > w - node.x || node.y < 0 || node.y > h){
+                FONS_LOG("Broken atlas cache %s",path);
+                return false;
+            }
+            right = node.x + node.width;
+            atlas.insert_node(atlas.nnodes,node.x,node.y,node.width);
+        }
+        if(r.ok && right != w){
+            FONS_LOG("Broken atlas cache %s",path);
+            return false;
+        }
+        int nfree = r.get<int32_t>();
+        if(nfree < 0 || size_t(nfree) > size_t(w) * h){
+            return false;
+        }
+        for(int k = 0;k < nfree && r.ok;k++){
+            auto rect = r.get<AtlasRect>();
+            if(r.ok && (rect.x < 0 || rect.y < 0 || rect.width <= 0 || rect.height <= 0 ||
+                        rect.width > w - rect.x || rect.height > h - rect.y)){
+                FONS_LOG("Broken atlas cache %s",path);
+                return false;
+            }
+            atlas.free_rects.push_back(rect);
+        }
+        auto bytes = r.take(page_bytes);
+        if(bytes == nullptr){
+            FONS_LOG("Broken atlas cache %s",path);
+            return false;
+        }
+        std::memcpy(p->bitmap.data(),bytes,page_bytes);
+        fresh.emplace_back(std::move(p));
+    }
+    uint32_t nfaces = r.get<uint32_t>();
+    if(!r.ok || nfaces > blob->size() / sizeof(CacheFace)){
+        return false;
+    }
+    std::vector<CacheFace> faces(nfaces);
+    for(auto &face : faces){
+        face = r.get<CacheFace>();
+    }
+    uint32_t nglyphs = r.get<uint32_t>();
+    if(!r.ok || nglyphs > blob->size() / sizeof(CacheGlyph)){
+        return false;
+    }
+    std::vector<CacheGlyph> glyphs(nglyphs);
+    bool valid = true;
+    for(auto &glyph : glyphs){
+        glyph = r.get<CacheGlyph>();
+        valid = valid && ValidCacheGlyph(glyph,w,h,n);
+    }
+    if(!r.ok || !valid){
+        FONS_LOG("Broken atlas cache %s",path);
+        return false;
+    }
+
+    //Find the fonts of the faces,hash only the files could be the same
+    std::vector<Ref<Font>> fonts;
+    {
+        std::lock_guard<std::mutex> lock(stash->mutex);
+        for(auto &it : stash->fonts){
+            fonts.push_back(it.second);
+        }
+    }
+    std::unordered_map<Blob*,uint64_t> hashes;
+    std::vector<Font::Shard*> matched(nfaces,nullptr);
+    for(uint32_t i = 0;i < nfaces;i++){
+        for(auto &font : fonts){
+            Face *face = font->face.get();
+            Uint  xdpi,ydpi;
+            face->get_dpi(&xdpi,&ydpi);
+            if(face->data()->size() != faces[i].size || face->face_index() != faces[i].index ||
+               face->load_flags() != faces[i].flags || xdpi != faces[i].xdpi || ydpi != faces[i].ydpi){
+                continue;
+            }
+            if(SameCacheFace(CacheFaceOf(face,hashes),faces[i])){
+                matched[i] = shard_of(font.get());
+                break;
+            }
+        }
+    }
+
+    //Replace the atlas
+    wait_glyphs();
+    pages.swap(fresh);
+    bitmap_w = w;
+    bitmap_h = h;
+    run_serial++;
+    atlas_epoch++;
+    reset_serial++;
+    pending.clear();
+    for(auto &it : shards){
+        it.second->glyphs.clear();
+    }
+    size_t dropped = 0;
+    for(auto &c : glyphs){
+        //Checked by ValidCacheGlyph
+        bool inside = c.x >= 0;
+        Font::Shard *owner = c.owner < nfaces ? matched[c.owner] : nullptr;
+        Font::Shard *face  = c.face  < nfaces ? matched[c.face]  : nullptr;
+        FontParams param;
+        param.context = this;
+        param.codepoint = c.codepoint;
+        param.blur = c.blur;
+        param.size = c.size;
+        param.flags = c.flags;
+        param.subpixel = c.subpixel;
+        if(owner == nullptr || face == nullptr || owner->glyphs.find(param) != nullptr){
+            //Font removed or changed,give the space back
+            if(inside){
+                pages[c.page]->atlas.free_rect(c.x,c.y,c.metrics[0],c.metrics[1]);
+            }
+            dropped++;
+            continue;
+        }
+        Glyph *g = owner->glyphs.insert(param);
+        static_cast<GlyphMetrics&>(*g) = {c.metrics[0],c.metrics[1],c.metrics[2],c.metrics[3],c.metrics[4],c.metrics[5]};
+        if(inside){
+            g->x = c.x;
+            g->y = c.y;
+            g->page = c.page;
+        }
+        g->face = face->face;
+        g->index = c.index;
+        g->generation = generation;
+    }
+    for(auto &p : pages){
+        p->mark_dirty(0,0,w,h);
+    }
+    FONS_LOG("Load atlas cache %s,%zu glyphs,%zu dropped",path,glyphs.size() - dropped,dropped);
+    return true;
+}
+bool Context::add_atlas_page(){
+    if(pages.size() >= FONS_MAX_ATLAS_PAGES){
+        return false;
+    }
+    pages.emplace_back(new Page(manager(),bitmap_w,bitmap_h));
+    return true;
+}
 
 //Atlas from nanovg
 Context::Atlas::Atlas(Manager *m,int w,int h){
     // Allocate memory for the font stash.
     int n = 255;
-    std::memset(this, 0, sizeof(Atlas));
     
     manager = m;
     width = w;
@@ -571,10 +2157,20 @@ void Context::Atlas::expend(int w,int h){
     width = w;
     height = h;
 }
+void Context::Atlas::swap(Atlas &other){
+    std::swap(manager, other.manager);
+    std::swap(width, other.width);
+    std::swap(height, other.height);
+    std::swap(nodes, other.nodes);
+    std::swap(nnodes, other.nnodes);
+    std::swap(cnodes, other.cnodes);
+    free_rects.swap(other.free_rects);
+}
 void Context::Atlas::reset(int w,int h){
     width = w;
     height = h;
     nnodes = 0;
+    free_rects.clear();
 
     // Init root node.
     nodes[0].x = 0;
@@ -637,6 +2233,9 @@ int  Context::Atlas::rect_fits(int i, int w, int h){
     return y;
 }
 bool Context::Atlas::add_rect(int rw, int rh, int* rx, int* ry){
+    // Try released space first
+    if (reuse_rect(rw, rh, rx, ry))
+        return true;
 
     int besth = height, bestw = width, besti = -1;
     int bestx = -1, besty = -1, i;
@@ -667,6 +2266,92 @@ bool Context::Atlas::add_rect(int rw, int rh, int* rx, int* ry){
 
     return 1;
 }
+bool Context::Atlas::reuse_rect(int rw, int rh, int* rx, int* ry){
+    // Best area fit
+    int best = -1;
+    int best_area = INT_MAX;
+    for (int i = 0; i < int(free_rects.size()); i++) {
+        auto &r = free_rects[i];
+        int area = r.width * r.height;
+        if (r.width >= rw && r.height >= rh && area < best_area) {
+            best = i;
+            best_area = area;
+        }
+    }
+    if (best == -1)
+        return false;
+
+    AtlasRect r = free_rects[best];
+    free_rects.erase(free_rects.begin() + best);
+
+    // Split the leftover space (guillotine)
+    if (r.width > rw)
+        free_rect(r.x + rw, r.y, r.width - rw, rh);
+    if (r.height > rh)
+        free_rect(r.x, r.y + rh, r.width, r.height - rh);
+
+    *rx = r.x;
+    *ry = r.y;
+    return true;
+}
+void Context::Atlas::free_rect(int x, int y, int w, int h){
+    if (w <= 0 || h <= 0)
+        return;
+    AtlasRect r;
+    r.x = (short)x;
+    r.y = (short)y;
+    r.width = (short)w;
+    r.height = (short)h;
+
+    // Merge with neighbours sharing a whole edge
+    bool merged = true;
+    while (merged) {
+        merged = false;
+        for (size_t i = 0; i < free_rects.size(); i++) {
+            AtlasRect &o = free_rects[i];
+            if (o.x == r.x && o.width == r.width &&
+               (o.y + o.height == r.y || r.y + r.height == o.y)) {
+                r.y = std::min(r.y, o.y);
+                r.height += o.height;
+            }
+            else if (o.y == r.y && o.height == r.height &&
+                    (o.x + o.width == r.x || r.x + r.width == o.x)) {
+                r.x = std::min(r.x, o.x);
+                r.width += o.width;
+            }
+            else {
+                continue;
+            }
+            free_rects.erase(free_rects.begin() + i);
+            merged = true;
+            break;
+        }
+    }
+    free_rects.push_back(r);
+}
+int  Context::Atlas::free_area() const{
+    int area = 0;
+    for (auto &r : free_rects)
+        area += r.width * r.height;
+    return area;
+}
+
+//Page
+Context::Page::Page(Manager *m,int w,int h):atlas(m,w,h),bitmap(w * h){
+    clear_dirty();
+}
+void Context::Page::mark_dirty(int x,int y,int w,int h){
+    dirty_rect[0] = std::min(dirty_rect[0],x);
+    dirty_rect[1] = std::min(dirty_rect[1],y);
+    dirty_rect[2] = std::max(dirty_rect[2],x + w);
+    dirty_rect[3] = std::max(dirty_rect[3],y + h);
+}
+void Context::Page::clear_dirty(){
+    dirty_rect[0] = atlas.width;
+    dirty_rect[1] = atlas.height;
+    dirty_rect[2] = 0;
+    dirty_rect[3] = 0;
+}
 
 void Context::get_atlas_size(int *w,int *h){
     *w = bitmap_w;
@@ -679,58 +2364,139 @@ void Context::expand_atlas(int w,int h){
     if(w == bitmap_w && h == bitmap_h){
         return;
     }
-    
-    std::vector<Pixel> new_map(w * h);
-    //Copy old map to new map
-    for(int y = 0;y < bitmap_h;y++){
-        for(int x = 0;x < bitmap_w;x++){
-            new_map[y * w + x] = bitmap[y * bitmap_w + x];
+    atlas_epoch++;
+    for(auto &p : pages){
+        std::vector<Pixel> new_map(w * h);
+        //Copy old map to new map
+        for(int y = 0;y < bitmap_h;y++){
+            for(int x = 0;x < bitmap_w;x++){
+                new_map[y * w + x] = p->bitmap[y * bitmap_w + x];
+            }
         }
-    }
-    //Increase atlas size
-    atlas.expend(w,h);
+        //Increase atlas size
+        p->atlas.expend(w,h);
 
-    //Mark as dirty
-    short maxy = 0;
-    for(int i = 0;i < atlas.nnodes;i++){
-        maxy = std::max(maxy,atlas.nodes[i].y);
-    }
+        //Mark as dirty
+        short maxy = 0;
+        for(int i = 0;i < p->atlas.nnodes;i++){
+            maxy = std::max(maxy,p->atlas.nodes[i].y);
+        }
 
-    dirty_rect[0] = 0;
-    dirty_rect[1] = 0;
-    dirty_rect[2] = bitmap_w;
-    dirty_rect[3] = maxy;
+        p->dirty_rect[0] = 0;
+        p->dirty_rect[1] = 0;
+        p->dirty_rect[2] = bitmap_w;
+        p->dirty_rect[3] = maxy;
 
-    bitmap = std::move(new_map);
+        p->bitmap = std::move(new_map);
+    }
     bitmap_w = w;
     bitmap_h = h;
 }
 void Context::reset_atlas(int w,int h){
-    bitmap.resize(w * h);
-    atlas.reset(w,h);
+    //Keep only one page
+    pages.resize(1);
+    auto &p = *pages[0];
+    p.bitmap.resize(w * h);
+    p.atlas.reset(w,h);
+    p.clear_dirty();
     bitmap_w = w;
     bitmap_h = h;
-    dirty_rect[0] = w;
-    dirty_rect[1] = h;
-    dirty_rect[2] = 0;
-    dirty_rect[3] = 0;
-
-    //TODO Reset Glyph in owned font
-    //Robustness: Get current draw font and reset it
-    int id  = states.top().font;
-    Font *ft = stash->get_font(id);
-    if(ft != nullptr){
-            ft->clear_cache_of(this);
+    run_serial++;
+    atlas_epoch++;
+    reset_serial++;
+    pending.clear();
+
+    //Reset Glyph in all fonts
+    for(auto &it : shards){
+        it.second->glyphs.clear();
+    }
+}
+bool Context::compact_atlas(std::vector<GlyphMove> *moves){
+    //Collect glyphs in atlas
+    std::vector<Glyph*> live;
+    for(auto &it : shards){
+        it.second->glyphs.for_each([&](Glyph &g){
+            if(g.x >= 0 && g.y >= 0){
+                live.push_back(&g);
+            }
+        });
     }
-
-    for(auto &f:fonts){
-        Font *font = f.get();
-        if(font == ft){
-            //Already reset , skip :)
-            continue;
+    //Tallest first,better for skyline
+    std::sort(live.begin(),live.end(),[](const Glyph *a,const Glyph *b){
+        if(a->height != b->height){
+            return a->height > b->height;
+        }
+        return a->width > b->width;
+    });
+    //Pack into fresh atlases,fill pages in order
+    std::vector<std::unique_ptr<Atlas>> fresh;
+    for(size_t n = 0;n < pages.size();n++){
+        fresh.emplace_back(new Atlas(manager(),bitmap_w,bitmap_h));
+    }
+    std::vector<GlyphMove> out(live.size());
+    size_t cur = 0;
+    for(size_t i = 0;i < live.size();i++){
+        Glyph *g = live[i];
+        int x,y;
+        while(cur < fresh.size() && !fresh[cur]->add_rect(g->width,g->height,&x,&y)){
+            cur++;
+        }
+        if(cur == fresh.size()){
+            FONS_LOG("Fail to repack atlas");
+            return false;
+        }
+        out[i].src_page = g->page;
+        out[i].dst_page = int(cur);
+        out[i].src_x = g->x;
+        out[i].src_y = g->y;
+        out[i].dst_x = x;
+        out[i].dst_y = y;
+        out[i].width = g->width;
+        out[i].height = g->height;
+    }
+    //Apply moves
+    std::vector<std::vector<Pixel>> new_maps(pages.size());
+    for(auto &map : new_maps){
+        map.resize(bitmap_w * bitmap_h);
+    }
+    for(size_t i = 0;i < out.size();i++){
+        auto &mv = out[i];
+        auto &src = pages[mv.src_page]->bitmap;
+        auto &dst = new_maps[mv.dst_page];
+        for(int y = 0;y < mv.height;y++){
+            std::memcpy(
+                &dst[(mv.dst_y + y) * bitmap_w + mv.dst_x],
+                &src[(mv.src_y + y) * bitmap_w + mv.src_x],
+                mv.width * sizeof(Pixel)
+            );
+        }
+        live[i]->page = mv.dst_page;
+        live[i]->x = mv.dst_x;
+        live[i]->y = mv.dst_y;
+    }
+    for(size_t n = 0;n < pages.size();n++){
+        auto &p = *pages[n];
+        p.bitmap = std::move(new_maps[n]);
+        p.atlas.swap(*fresh[n]);
+
+        //Mark used area as dirty
+        short maxy = 0;
+        for(int i = 0;i < p.atlas.nnodes;i++){
+            maxy = std::max(maxy,p.atlas.nodes[i].y);
         }
-        font->clear_cache_of(this);
+        p.dirty_rect[0] = 0;
+        p.dirty_rect[1] = 0;
+        p.dirty_rect[2] = bitmap_w;
+        p.dirty_rect[3] = std::max<int>(maxy,p.dirty_rect[3]);
     }
+
+    atlas_epoch++;
+    FONS_LOG("Compact atlas with %d glyphs",int(out.size()));
+
+    if(moves != nullptr){
+        *moves = std::move(out);
+    }
+    return true;
 }
 
 void TransformByAlign(
@@ -779,16 +2545,32 @@ TextRenderer::TextRenderer(Fontstash &s,int w,int h):Context(s,w,h){
         if(code != FONS_ATLAS_FULL){
             return false;//Unhandled error
         }
-        //Resize
         TextRenderer *t = (TextRenderer*)self;
         int w,h;
         t->get_atlas_size(&w,&h);
+        //Enough released space,reclaim it instead of growing
+        if(t->free_area() * 4 >= w * h * t->atlas_pages() && t->compact()){
+            FONS_LOG("Compact atlas %d,%d",w,h);
+            return true;
+        }
+        //Add a new page with the same size
+        if(t->add_atlas_page()){
+            FONS_LOG("Add atlas page %d",t->atlas_pages());
+            return true;
+        }
+        //No more page,resize all of them(up to the max size)
+        int nw = std::min(w * 2,t->max_atlas_size);
+        int nh = std::min(h * 2,t->max_atlas_size);
+        if(nw <= w && nh <= h){
+            FONS_LOG("Atlas reached the max size %d",t->max_atlas_size);
+            return false;
+        }
         t->expand(
-            w * 2,
-            h * 2
+            std::max(nw,w),
+            std::max(nh,h)
         );
         
-        FONS_LOG("Resize atlas to %d,%d",w,h);
+        FONS_LOG("Resize atlas to %d,%d",nw,nh);
 
         return true;
     },this);
@@ -800,97 +2582,305 @@ void TextRenderer::draw_text(float x,float y,const char *str,const char *end){
     if(end == nullptr){
         end = str + std::strlen(str);
     }
-    auto font = stash->get_font(states.top().font);
-    if(font == nullptr){
+    if(max_runs != 0){
+        draw_cached(x,y,str,end);
+        return;
+    }
+    //Lay out once,the glyphs are placed in the atlas here
+    if(!layout_text(str,end,FONS_GLYPH_BITMAP_REQUIRED,run)){
         return;
     }
-    //Get size
-    auto size = measure_text(str,end);
-    //Begin iterator
-    auto m = font->metrics_of(states.top().size);
-    //Is first?
-    bool first = true;
-    Uint prev = 0;
-
     //Transform back
     TransformByAlign(
         &x,&y,
         states.top().align,
-        size,
-        m
+        run.size,
+        run.metrics
     );
-
-    while(str < end){
-        char32_t c = Utf8Decode(str);
-        FontParams param;
-        param.context = this;
-        param.codepoint = c;
-        param.size = states.top().size;
-        param.blur = states.top().blur;
-        //Kerning / Spacing
-        if(!first){
-            x += font->kerning(param.size,prev,c);
-            x += states.top().spacing;
-        }
-        else{
-            first = false;
+    if(run.subpixel){
+        x = std::floor(x + 0.5f);
+    }
+    emit_run(x,y,vertices);
+}
+void TextRenderer::emit_run(float x,float y,std::vector<Vertex> &out){
+    //Unresolved glyphs are drawn as the placeholder or skipped
+    Glyph *ph = nullptr;
+    if(placeholder && run.ticket != 0){
+        uint32_t resets = reset_serial;
+        ph = placeholder_glyph();
+        if(reset_serial != resets){
+            //The glyphs of run are gone with the atlas
+            return;
         }
-        prev = c;
-
-        //Send to find
-        Glyph *g = font->get_glyph(param,FONS_GLYPH_BITMAP_REQUIRED);
-        if(g == nullptr){
-            //No Glyph?
-            break;
+    }
+    //Atlas may be compacted in layout,so read the glyphs after it
+    auto &m = run.metrics;
+    float scale = run.scale;
+    Color color = states.top().color;
+    for(auto &rg : run.glyphs){
+        Glyph *g = rg.glyph;
+        if(g->ticket != 0 && ph == nullptr){
+            continue;
         }
-        float yoffset = m.ascender - g->bitmap_top;
-        float xoffset = g->bitmap_left;
+        float yoffset = m.ascender - g->bitmap_top * scale;
+        float xoffset = g->bitmap_left * scale;
+        //The pen fraction is in the bitmap
+        float pen = run.subpixel ? std::floor(rg.x) : rg.x;
 
         //Make vert
         Vertex vert;
 
+        vert.page    = g->page;
         vert.glyph_x = g->x;
         vert.glyph_y = g->y;
         vert.glyph_w = g->width;
         vert.glyph_h = g->height;
 
         //Screen dst
-        vert.screen_x = x + xoffset;
+        vert.screen_x = x + pen + xoffset;
         vert.screen_y = y + yoffset;
-        vert.screen_w = g->width;
-        vert.screen_h = g->height;
-
-        vert.c = states.top().color;
+        vert.screen_w = g->width * scale;
+        vert.screen_h = g->height * scale;
+
+        vert.c = color;
+        vert.sdf_scale = (g->flags & FONS_GLYPH_SDF) ? scale : 0;
+
+        if(g->ticket != 0){
+            //Stretch the center texel of the solid glyph
+            vert.page    = ph->page;
+            vert.glyph_x = ph->x + 1;
+            vert.glyph_y = ph->y + 1;
+            vert.glyph_w = 1;
+            vert.glyph_h = 1;
+            vert.sdf_scale = 0;
+        }
 
         //Add vert
-        add_vert(vert);
+        out.push_back(vert);
+    }
+}
+void TextRenderer::draw_cached(float x,float y,const char *str,const char *end){
+    auto &state = states.top();
+    Font *font = font_of(state.font);
+    if(font == nullptr){
+        return;
+    }
+    //FNV-1a on text and params
+    uint64_t hash = 14695981039346656037ULL;
+    auto mix = [&](const void *data,size_t n){
+        auto bytes = static_cast<const uint8_t*>(data);
+        for(size_t i = 0;i < n;i++){
+            hash ^= bytes[i];
+            hash *= 1099511628211ULL;
+        }
+    };
+    mix(str,end - str);
+    mix(&font,sizeof(font));
+    mix(&state.size,sizeof(state.size));
+    mix(&state.spacing,sizeof(state.spacing));
+    mix(&state.blur,sizeof(state.blur));
+    mix(&state.sdf,sizeof(state.sdf));
+    mix(&state.subpixel,sizeof(state.subpixel));
+
+    CachedRun *entry = nullptr;
+    auto iter = runs.find(hash);
+    if(iter != runs.end()){
+        auto &e = iter->second;
+        if(e.epoch == atlas_epoch && e.font.get() == font && e.size == state.size && 
+           e.spacing == state.spacing && e.blur == state.blur && e.sdf == state.sdf && e.subpixel == state.subpixel &&
+           e.text.compare(0,std::string::npos,str,end - str) == 0){
+            entry = &e;
+        }
+    }
+    if(entry == nullptr){
+        //Miss,lay out and keep the vertices relative to origin
+        if(!layout_text(str,end,FONS_GLYPH_BITMAP_REQUIRED,run)){
+            return;
+        }
+        if(iter == runs.end() && runs.size() >= max_runs && run.ticket == 0){
+            //Drop the runs not used in this frame
+            for(auto it = runs.begin();it != runs.end();){
+                if(it->second.generation != generation){
+                    it = runs.erase(it);
+                }
+                else{
+                    ++it;
+                }
+            }
+        }
+        if((iter == runs.end() && runs.size() >= max_runs) || run.ticket != 0){
+            //Too many runs in a frame or glyphs not ready,draw it directly
+            float ox = x;
+            float oy = y;
+            TransformByAlign(&ox,&oy,state.align,run.size,run.metrics);
+            if(run.subpixel){
+                ox = std::floor(ox + 0.5f);
+            }
+            emit_run(ox,oy,vertices);
+            return;
+        }
+        entry = &runs[hash];
+        entry->text.assign(str,end);
+        entry->font = font;
+        entry->size = state.size;
+        entry->spacing = state.spacing;
+        entry->blur = state.blur;
+        entry->sdf = state.sdf;
+        entry->subpixel = run.subpixel;
+        entry->epoch = atlas_epoch;
+        entry->extent = run.size;
+        entry->metrics = run.metrics;
+        entry->glyphs.clear();
+        for(auto &rg : run.glyphs){
+            entry->glyphs.push_back(rg.glyph);
+        }
+        entry->vertices.clear();
+        emit_run(0,0,entry->vertices);
+    }
+    else{
+        //Hit,keep the glyphs alive in this frame
+        for(Glyph *g : entry->glyphs){
+            g->generation = generation;
+        }
+    }
+    entry->generation = generation;
 
-        //Move forward
-        x += g->advance_x;
+    //Transform back and translate
+    TransformByAlign(&x,&y,state.align,entry->extent,entry->metrics);
+    if(entry->subpixel){
+        x = std::floor(x + 0.5f);
+    }
+    Color color = state.color;
+    for(Vertex vert : entry->vertices){
+        vert.screen_x += x;
+        vert.screen_y += y;
+        vert.c = color;
+        vertices.push_back(vert);
+    }
+}
+void TextRenderer::set_run_cache(size_t max){
+    max_runs = max;
+    if(max_runs == 0){
+        runs.clear();
     }
 }
 void TextRenderer::flush(){
-    if(has_dirty()){
+    submit();
+    next_frame();
+}
+void TextRenderer::submit(){
+    //Glyphs landed in background are uploaded with others
+    poll_glyphs();
+    for(int page = 0;page < atlas_pages();page++){
         //Notify update dirty
-
         int dirty[4];
-        validate(dirty);
+        if(!validate(page,dirty)){
+            continue;
+        }
 
         int x = dirty[0];
         int y = dirty[1];
         int w = dirty[2] - dirty[0];
         int h = dirty[3] - dirty[1];
 
-        render_update(x,y,w,h);
+        render_update(page,x,y,w,h);
     }
     if(!vertices.empty()){
         //Let renderer draw
-
-        render_draw(vertices.data(),vertices.size());
+        if(batch_output){
+            submit_batches();
+        }
+        else{
+            render_draw(vertices.data(),vertices.size());
+        }
         render_flush();
         vertices.clear();
     }
 }
+void TextRenderer::submit_batches(){
+    size_t nquads = vertices.size();
+    batch_verts.resize(nquads * 8);
+    batch_tcoords.resize(nquads * 8);
+    batch_colors.resize(nquads * 4);
+    //Indices only grow,so they are generated once
+    size_t ready = quad_indices.size() / 6;
+    if(ready < nquads){
+        quad_indices.resize(nquads * 6);
+        for(size_t n = ready;n < nquads;n++){
+            uint32_t base = n * 4;
+            uint32_t *idx = quad_indices.data() + n * 6;
+            idx[0] = base + 0;
+            idx[1] = base + 1;
+            idx[2] = base + 2;
+            idx[3] = base + 0;
+            idx[4] = base + 2;
+            idx[5] = base + 3;
+        }
+    }
+    float itw = 1.0f / bitmap_w;
+    float ith = 1.0f / bitmap_h;
+
+    //Fill all quads in one pass,a batch is a run of the same page
+    float    *pos = batch_verts.data();
+    float    *uv  = batch_tcoords.data();
+    uint32_t *col = batch_colors.data();
+    size_t begin = 0;
+    for(size_t n = 0;n < nquads;n++){
+        const Vertex &vert = vertices[n];
+
+        float x0 = vert.screen_x;
+        float y0 = vert.screen_y;
+        float x1 = vert.screen_x + vert.screen_w;
+        float y1 = vert.screen_y + vert.screen_h;
+        float s0 = vert.glyph_x * itw;
+        float t0 = vert.glyph_y * ith;
+        float s1 = (vert.glyph_x + vert.glyph_w) * itw;
+        float t1 = (vert.glyph_y + vert.glyph_h) * ith;
+
+        pos[0] = x0; pos[1] = y0;
+        pos[2] = x1; pos[3] = y0;
+        pos[4] = x1; pos[5] = y1;
+        pos[6] = x0; pos[7] = y1;
+
+        uv[0] = s0; uv[1] = t0;
+        uv[2] = s1; uv[3] = t0;
+        uv[4] = s1; uv[5] = t1;
+        uv[6] = s0; uv[7] = t1;
+
+        //RRGGBBAA to R,G,B,A bytes
+        uint8_t rgba[4] = {
+            uint8_t(vert.c >> 24),
+            uint8_t(vert.c >> 16),
+            uint8_t(vert.c >> 8),
+            uint8_t(vert.c)
+        };
+        std::memcpy(&col[0],rgba,4);
+        col[1] = col[0];
+        col[2] = col[0];
+        col[3] = col[0];
+
+        pos += 8;
+        uv  += 8;
+        col += 4;
+
+        if(n + 1 == nquads || vertices[n + 1].page != vert.page){
+            DrawBatch batch;
+            batch.verts    = batch_verts.data() + begin * 8;
+            batch.tcoords  = batch_tcoords.data() + begin * 8;
+            batch.colors   = batch_colors.data() + begin * 4;
+            batch.indices  = quad_indices.data();
+            batch.page     = vert.page;
+            batch.nverts   = (n + 1 - begin) * 4;
+            batch.nindices = (n + 1 - begin) * 6;
+            render_batch(batch);
+            begin = n + 1;
+        }
+    }
+}
+void TextRenderer::render_batch(const DrawBatch &batch){
+    //Override it to use batch output
+    LILIM_UNUSED(batch);
+}
 void TextRenderer::draw_vtext(float x,float y,const char *fmt,...){
     if(fmt == nullptr){
         return;
@@ -935,15 +2925,31 @@ void TextRenderer::add_vert(const Vertex &vert){
 }
 void TextRenderer::expand(int w,int h){
     //First flush the current vertices
-    flush();
+    submit();
     //Expand the atlas
     Context::expand_atlas(w,h);
     //Notify the render
     render_resize(w,h);
 }
+bool TextRenderer::compact(){
+    //First flush the current vertices
+    submit();
+    //Repack the atlas,whole used area will be updated by dirty rect
+    return Context::compact_atlas();
+}
+bool TextRenderer::load_cache(const char *path){
+    //First flush the current vertices
+    submit();
+    if(!Context::load_cache(path)){
+        return false;
+    }
+    //Notify the render,the pages are uploaded by dirty rect
+    render_resize(bitmap_w,bitmap_h);
+    return true;
+}
 void TextRenderer::reset(int w,int h){
     //First flush the current vertices
-    flush();
+    submit();
     //Reset the atlas
     Context::reset_atlas(w,h);
     //Notify the render
@@ -962,20 +2968,25 @@ bool TextIter::init(Context *ctxt,float x,float y,const char* str,const char* en
     auto &state = ctxt->states.top();
 
     //Measure
-    this->font = ctxt->stash->get_font(
+    this->font = ctxt->font_of(
         state.font
     );
     if(this->font == nullptr){
         return false;
     }
-    auto size = ctxt->measure_text(str,end);
+    //Lay out once,to_next consumes the run while it is valid
+    auto &run = ctxt->iter_run;
+    ctxt->run_serial++;
+    ctxt->layout_text(str,end,bitmapOption,run);
 
-    this->width = size.width;
-    this->height = size.height;
+    this->width = run.size.width;
+    this->height = run.size.height;
     //Transform back
-    this->metrics = font->metrics_of(state.size);
-    TransformByAlign(&x,&y,state.align,size,metrics);
-
+    this->metrics = run.metrics;
+    TransformByAlign(&x,&y,state.align,run.size,metrics);
+    if(run.subpixel){
+        x = std::floor(x + 0.5f);
+    }
 
     this->x = this->nextx = x;
     this->y = this->nexty = y;
@@ -987,9 +2998,15 @@ bool TextIter::init(Context *ctxt,float x,float y,const char* str,const char* en
     this->prevGlyphIndex = -1;
     this->bitmapOption = bitmapOption;
     this->context = ctxt;
-
-    this->iblur = state.blur;
-    this->isize = state.size;
+    this->originx = x;
+    this->runIndex = 0;
+    this->runSerial = ctxt->run_serial;
+
+    this->iblur = state.sdf ? 0 : state.blur;
+    this->isize = state.sdf ? FONS_SDF_SIZE : state.size;
+    this->iflags = state.sdf ? FONS_GLYPH_SDF : 0;
+    this->scale = run.scale;
+    this->subpixel = run.subpixel;
     this->spacing = state.spacing;
 
     #ifndef FONS_NDEBUG
@@ -1004,51 +3021,100 @@ bool TextIter::to_next(Quad *quad){
     if(str == end){
         return false;
     }
-    char32_t ch = Utf8Decode(str);
-
-    FontParams params;
-    params.codepoint = ch;
-    params.blur = iblur;
-    params.size = isize;
-    params.context = context;
-
-    glyph = font->get_glyph(params,bitmapOption);
-    if(glyph == nullptr){
-        //No glyph :(
-        //Accroding to orginal code,we should set prev into -1
-        prevGlyphIndex = -1;
-        return true;
+    auto &run = context->iter_run;
+    if(runSerial != 0){
+        if(runSerial != context->run_serial){
+            //Run is invalid,str is already after the consumed chars
+            runSerial = 0;
+        }
+        else if(runIndex == run.glyphs.size()){
+            //Run is done(maybe stopped at a missing glyph)
+            str = run.stop;
+            runSerial = 0;
+        }
+        if(str == end){
+            return false;
+        }
     }
-
-    if(prevGlyphIndex != -1){
-        //Add kerning and spacing
-        nextx  += font->kerning(params.size,prevGlyphIndex,ch);
-        nextx  += spacing;
+    if(runSerial != 0){
+        //Already laid out
+        auto &rg = run.glyphs[runIndex++];
+        //Move forward by one char like decoding
+        next = run.start + rg.offset;
+        str  = runIndex < run.glyphs.size() ? run.start + run.glyphs[runIndex].offset : run.stop;
+        glyph = rg.glyph;
+        prevGlyphIndex = glyph->codepoint;
+        nextx = originx + rg.x;
+        x = subpixel ? std::floor(nextx) : nextx;
+        y = nexty;
     }
-    prevGlyphIndex = ch;
+    else{
+        //Decode it
+        char32_t ch;
+        next = str;
+        Utf8Decode(str,end,&ch,1);
+
+        FontParams params;
+        params.codepoint = ch;
+        params.blur = iblur;
+        params.size = isize;
+        params.flags = iflags;
+        params.subpixel = 0;
+        params.context = context;
+
+        float pen = nextx;
+        if(prevGlyphIndex != -1){
+            //Add kerning and spacing
+            pen  += font->kerning(context,params.size,prevGlyphIndex,ch) * scale;
+            pen  += spacing;
+        }
+        float gx = pen;
+        if(subpixel){
+            //Origin is snapped,so the fraction is same as the run
+            gx = std::floor(pen);
+            params.subpixel = short((pen - gx) * FONS_SUBPIXEL_LEVELS);
+        }
+
+        glyph = font->get_glyph(params,bitmapOption);
+        if(glyph == nullptr){
+            //No glyph :(
+            //Accroding to orginal code,we should set prev into -1
+            prevGlyphIndex = -1;
+            return true;
+        }
+        nextx = pen;
+        prevGlyphIndex = ch;
 
-    x = nextx;
-    y = nexty;
+        x = gx;
+        y = nexty;
+    }
 
     //Generate quad
     float itw = 1.0f / context->bitmap_w;
     float ith = 1.0f / context->bitmap_h;
     //Mark glyph output
-    float y_offset = metrics.ascender - glyph->bitmap_top;
-    float x_offset = glyph->bitmap_left;
+    float y_offset = metrics.ascender - glyph->bitmap_top * scale;
+    float x_offset = glyph->bitmap_left * scale;
     float act_x = x + x_offset;
     float act_y = y + y_offset;
 
     quad->x0 = act_x;
-    quad->x1 = act_x + glyph->width;
+    quad->x1 = act_x + glyph->width * scale;
     quad->y0 = act_y;
-    quad->y1 = act_y + glyph->height;
+    quad->y1 = act_y + glyph->height * scale;
 
     //Mark glyph source
     quad->s0 = glyph->x * itw;
     quad->t0 = glyph->y * ith;
     quad->s1 = (glyph->x + glyph->width) * itw;
     quad->t1 = (glyph->y + glyph->height)* ith;
+    quad->page = glyph->page;
+    quad->sdf_scale = (glyph->flags & FONS_GLYPH_SDF) ? scale : 0;
+    if(glyph->ticket != 0){
+        //Rasterizing in background,output an empty quad
+        quad->x1 = quad->x0;
+        quad->y1 = quad->y0;
+    }
 
     //Debug print
     #ifndef FONS_NDEBUG
@@ -1061,7 +3127,7 @@ bool TextIter::to_next(Quad *quad){
     );
     #endif
     //Move forward
-    nextx += glyph->advance_x;
+    nextx += subpixel ? glyph->advance_x64 / 64.0f : glyph->advance_x * scale;
 
     return true;
 }
@@ -1114,6 +3180,29 @@ FONS_CAPI(void         ) fonsSetFont(FONScontext *s,int font){
 FONS_CAPI(void         ) fonsSetBlur(FONScontext *s,int blur){
     return s->set_blur(blur);
 }
+FONS_CAPI(void         ) fonsSetSDF(FONScontext *s,int sdf){
+    return s->set_sdf(sdf != 0);
+}
+FONS_CAPI(void         ) fonsSetSubpixel(FONScontext *s,int subpixel){
+    return s->set_subpixel(subpixel != 0);
+}
+FONS_CAPI(void         ) fonsSetRasterThreads(FONScontext *s,int n){
+    return s->set_raster_threads(n);
+}
+FONS_CAPI(void         ) fonsSetAsync(FONScontext *s,int async){
+    return s->set_async(async);
+}
+FONS_CAPI(unsigned int ) fonsPollGlyphs(FONScontext *s){
+    return s->poll_glyphs();
+}
+FONS_CAPI(int          ) fonsPrewarm(FONScontext *s,const unsigned int *ranges,int nranges,const float *sizes,int nsizes){
+    std::vector<FONS_NAMESPACE::CodepointRange> list(nranges);
+    for(int i = 0;i < nranges;i++){
+        list[i].first = ranges[i * 2];
+        list[i].last  = ranges[i * 2 + 1];
+    }
+    return s->prewarm(list.data(),list.size(),sizes,nsizes);
+}
 FONS_CAPI(void         ) fonsSetAlign(FONScontext *s,int align){
     return s->set_align(align);
 }
@@ -1227,5 +3316,11 @@ FONS_CAPI(void         ) fonsExpandAtlas(FONScontext *s,int width,int height){
 FONS_CAPI(void         ) fonsResetAtlas(FONScontext *s,int width,int height){
     return s->reset_atlas(width,height);
 }
+FONS_CAPI(int          ) fonsSaveAtlasCache(FONScontext *s,const char *path){
+    return s->save_cache(path);
+}
+FONS_CAPI(int          ) fonsLoadAtlasCache(FONScontext *s,const char *path){
+    return s->load_cache(path);
+}
 
 #endif
\ No newline at end of file
@@ -40,10 +40,61 @@
     #define FONS_MAX_CACHED_GLYPHS (1024 * 4)
 #endif
 
+#ifndef FONS_EVICT_GLYPHS
+    #define FONS_EVICT_GLYPHS (FONS_MAX_CACHED_GLYPHS / 8)
+#endif
+
+#ifndef FONS_MAX_ATLAS_PAGES
+    #define FONS_MAX_ATLAS_PAGES 8
+#endif
+
+//Max width / height of an atlas page grown by TextRenderer
+#ifndef FONS_MAX_ATLAS_SIZE
+    #define FONS_MAX_ATLAS_SIZE 4096
+#endif
+
+#ifndef FONS_MAX_KERNING_PAIRS
+    #define FONS_MAX_KERNING_PAIRS (1024 * 16)
+#endif
+
+#ifndef FONS_MAX_FALLBACK_CACHE
+    #define FONS_MAX_FALLBACK_CACHE (1024 * 4)
+#endif
+
 #ifndef FONS_MAX_FONT_SIZE
     #define FONS_MAX_FONT_SIZE 100
 #endif
 
+//Max blur radius(same as nanovg),each blur value has its own glyphs
+#ifndef FONS_MAX_BLUR
+    #define FONS_MAX_BLUR 20
+#endif
+
+//Number of horizontal subpixel positions of a glyph
+#ifndef FONS_SUBPIXEL_LEVELS
+    #define FONS_SUBPIXEL_LEVELS 4
+#endif
+
+//Max size using subpixel positioning(bigger text gains little from it)
+#ifndef FONS_SUBPIXEL_MAX_SIZE
+    #define FONS_SUBPIXEL_MAX_SIZE 32
+#endif
+
+//Min number of missing glyphs in a run to rasterize them in parallel(see Context::set_raster_threads)
+#ifndef FONS_RASTER_BATCH_MIN
+    #define FONS_RASTER_BATCH_MIN 8
+#endif
+
+//Coverage of the placeholder drawn for glyphs still rasterizing in background(see TextRenderer::set_placeholder)
+#ifndef FONS_PLACEHOLDER_COVERAGE
+    #define FONS_PLACEHOLDER_COVERAGE 64
+#endif
+
+//The size of cached signed distance field glyphs(scaled to any size)
+#ifndef FONS_SDF_SIZE
+    #define FONS_SDF_SIZE 48
+#endif
+
 #ifdef FONS_CLEARTYPE
     #ifdef LILIM_STBTRUETYPE
         #error "backend must be freetype"
@@ -63,9 +114,14 @@
 #endif
 
 #include <unordered_map>
+#include <algorithm>
 #include <functional>
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
+#include <deque>
 #include <stack>
 #include <map>
 #include <set>
@@ -88,6 +144,13 @@ enum {
 enum {
 	FONS_GLYPH_BITMAP_OPTIONAL = 0,
 	FONS_GLYPH_BITMAP_REQUIRED = 1,
+	// Reserve the atlas rect only,the bitmap is rasterized with the other glyphs of the run
+	FONS_GLYPH_BITMAP_DEFERRED = 2,
+};
+
+enum {
+	// Glyph bitmap is a signed distance field at FONS_SDF_SIZE
+	FONS_GLYPH_SDF = 1<<0,
 };
 
 enum {
@@ -123,6 +186,8 @@ class FontParams {
         char32_t codepoint;// < Codepoint
         short blur;
         short size;
+        short flags;//< FONS_GLYPH_XXX flags
+        short subpixel;//< Horizontal subpixel position in [0,FONS_SUBPIXEL_LEVELS)
 };
 /**
  * @brief Cached Glyph
@@ -132,11 +197,171 @@ class Glyph : public GlyphMetrics , public FontParams {
     public:
         int x = -1;//< In bitmap position (-1 on bitmap was not created)
         int y = -1;
+        int page = 0;//< The atlas page of the bitmap
+        uint32_t generation = 0;//< The frame generation of last use
+        Ref<Face> face;//< The resolved face(self or fallback)
+        Uint index = 0;//< The glyph index in the face
+        uint32_t ticket = 0;//< The background batch rasterizing the bitmap(0 on ready,see Context::set_async)
+};
+/**
+ * @brief Counters of the glyph cache
+ * 
+ */
+class CacheStats {
+    public:
+        size_t hits = 0;
+        size_t misses = 0;
+        size_t evictions = 0;
+};
+
+/**
+ * @brief Open addressing glyph table keyed on (codepoint,size,blur,flags,subpixel,context)
+ * 
+ * @note Glyphs are stored in a deque,so the returned pointers are stable until erased
+ */
+class GlyphCache {
+    public:
+        GlyphCache() = default;
+        GlyphCache(const GlyphCache &) = delete;
+        ~GlyphCache() = default;
+        /**
+         * @brief Find a glyph with the same key
+         * 
+         * @param param 
+         * @return Glyph* (nullptr on not found)
+         */
+        Glyph *find(const FontParams &param);
+        /**
+         * @brief Insert a new glyph with the key(the key must not exist)
+         * 
+         * @param param 
+         * @return Glyph* 
+         */
+        Glyph *insert(const FontParams &param);
+        /**
+         * @brief Remove a glyph from the table
+         * 
+         * @param glyph 
+         */
+        void   erase(Glyph *glyph);
+        /**
+         * @brief Remove all glyphs matching the predicate
+         * 
+         * @param pred bool(Glyph &)
+         */
+        template<class Fn>
+        void   erase_if(Fn &&pred);
+        /**
+         * @brief Visit all glyphs in the table
+         * 
+         * @param fn void(Glyph &)
+         */
+        template<class Fn>
+        void   for_each(Fn &&fn);
+        void   clear();
+
+        size_t size() const noexcept{
+            return count;
+        }
+    private:
+        struct Slot {
+            uint32_t hash;
+            uint32_t index;//< Index in storage + 1 (0 on empty)
+        };
+        static uint32_t hash_of(const FontParams &param);
+        static bool     same_key(const FontParams &a,const FontParams &b){
+            return a.codepoint == b.codepoint &&
+                   a.size == b.size &&
+                   a.blur == b.blur &&
+                   a.flags == b.flags &&
+                   a.subpixel == b.subpixel &&
+                   a.context == b.context;
+        }
+        void   rehash(size_t capacity);
+        void   place(uint32_t hash,uint32_t index);
+
+        std::vector<Slot>     slots;//< Power of two
+        std::deque<Glyph>     storage;
+        std::vector<uint32_t> free_list;
+        size_t                count = 0;
+};
+
+/**
+ * @brief Open addressing table of kerning distance keyed on glyph indices(at one size)
+ * 
+ */
+class KerningCache {
+    public:
+        /**
+         * @brief Find the kerning of the pair
+         * 
+         * @param left The left glyph index
+         * @param right The right glyph index
+         * @param value The kerning distance
+         * @return true On found
+         */
+        bool find(Uint left,Uint right,Int *value) const;
+        void insert(Uint left,Uint right,Int value);
+        void clear();
+
+        size_t size() const noexcept{
+            return count;
+        }
+    private:
+        static constexpr uint64_t Empty = ~uint64_t(0);
+        struct Entry {
+            uint64_t key;
+            Int      value;
+        };
+        static uint64_t key_of(Uint left,Uint right){
+            return (uint64_t(left) << 32) | right;
+        }
+        static size_t   hash_of(uint64_t key){
+            key *= 0x9E3779B97F4A7C15ull;
+            return size_t(key >> 32);
+        }
+
+        std::vector<Entry> entries;//< Power of two
+        size_t             count = 0;
+};
+
+/**
+ * @brief Resolved faces of codepoints missing in the primary face
+ * 
+ */
+class FallbackCache {
+    public:
+        /**
+         * @brief Find the resolved face of the codepoint
+         * 
+         * @param codepoint 
+         * @param face The resolved face(nullptr on no face has it)
+         * @param index The glyph index in the face
+         * @return true On found
+         */
+        bool find(char32_t codepoint,Face **face,Uint *index) const;
+        void insert(char32_t codepoint,Face *face,Uint index);
+        void clear();
+
+        size_t size() const noexcept{
+            return count;
+        }
+    private:
+        static constexpr char32_t Empty = ~char32_t(0);
+        struct Entry {
+            char32_t codepoint;
+            Uint     index;
+            Face    *face;
+        };
+        std::vector<Entry> entries;//< Power of two
+        size_t             count = 0;
 };
 
 /**
  * @brief Logical font
  *
+ * @note The font data is shared,each context has its own glyphs,caches and face(see Shard),
+ *       so contexts in different threads can use the same font without locking
  */
 class Font: public Refable<Font> {
     public:
@@ -147,40 +372,29 @@ class Font: public Refable<Font> {
         /**
          * @brief Get the glyph object
          * 
-         * @param param The required glyph's params
+         * @param param The required glyph's params(cached in param.context)
          * @param req_bitmap Does the bitmap is needed?
          * @return Glyph* 
          */
         Glyph      *get_glyph(FontParams param,int req_bitmap);
         /**
-         * @brief Get metrics of font with size
+         * @brief Get metrics of font with size(cached by size)
          * 
+         * @param ctxt The context to use
          * @param size 
          * @return FaceMetrics 
          */
-        FaceMetrics metrics_of(float size){
-            face->set_size(size);
-            return face->metrics();
-        }
+        FaceMetrics metrics_of(Context *ctxt,float size);
         /**
          * @brief Get kerning distance between two glyphs
          * 
+         * @param ctxt The context to use
          * @param size The size of the font
          * @param prev The left glyph codepoint
          * @param cur The right glyph codepoint
          * @return Uint 
          */
-        Int kerning(float size,char32_t prev,char32_t cur){
-#ifndef FONS_NO_KERNING
-            face->set_size(size);
-            return face->kerning(face->glyph_index(prev),face->glyph_index(cur));
-#else
-            LILIM_UNUSED(size);
-            LILIM_UNUSED(prev);
-            LILIM_UNUSED(cur);
-            return 0;
-#endif
-        }
+        Int kerning(Context *ctxt,float size,char32_t prev,char32_t cur);
         void set_name(const char *name){
             this->name = name;
         }
@@ -188,54 +402,99 @@ class Font: public Refable<Font> {
          * @brief Reset current fallbacks
          * 
          */
-        void reset_fallbacks(){
-            fallbacks.clear();
-        }
+        void reset_fallbacks();
         /**
          * @brief Add a fallback font id into fallbacks
          * 
          * @param f 
          */
-        void add_fallback(int f){
-            if(f == id){
-                return;
-            }
-            fallbacks.emplace_back(f);
-        }
+        void add_fallback(int f);
         int get_id(){
             return id;
         }
+        /**
+         * @brief Get the counters of the glyph cache(summed over contexts)
+         * 
+         * @note Counters of contexts rendering in other threads may be stale
+         * @return CacheStats 
+         */
+        CacheStats cache_stats();
+        void reset_stats();
     private:
         Font();
         /**
-         * @brief Get Glyph in cache
+         * @brief Cached state of one size
          * 
-         * @param param 
-         * @param req_bitmap Does the bitmap is needed?
-         * @return Glyph* 
          */
-        Glyph *query_cache(FontParams param,int req_bitmap);
+        struct SizeInfo {
+            bool         cached = false;
+            bool         kerning_filled = false;
+            FaceMetrics  metrics;
+            KerningCache kerning;
+        };
+        /**
+         * @brief Mutable state of the font in one context,only touched by the thread of the context
+         * 
+         */
+        struct Shard {
+            Context              *context = nullptr;
+            Ref<Font>             font;
+            Ref<Face>             face;//< The face of font(first context) or a clone of it
+            GlyphCache            glyphs;
+            std::vector<SizeInfo> sizes;//< Indexed by size
+            FallbackCache         resolved;//< Invalidated when fallbacks changed
+            CacheStats            stats;
+        };
+        /**
+         * @brief Evict the least recently used glyphs of the context
+         * 
+         * @note Glyphs used in the current frame of the context are kept
+         * @param s 
+         */
+        void   evict(Shard &s);
+        /**
+         * @brief Get kerning of two glyph indices by the kerning cache
+         * 
+         * @param s 
+         * @param size 
+         * @param left 
+         * @param right 
+         * @return Int 
+         */
+        Int    kerning_of(Shard &s,float size,Uint left,Uint right);
+        /**
+         * @brief Get the cached state of the size
+         * 
+         * @param s 
+         * @param size 
+         * @return SizeInfo* (nullptr on out of cache range)
+         */
+        SizeInfo *size_info(Shard &s,float size);
         /**
-         * @brief Get a Face with existing codepoint
+         * @brief Get a Face with existing codepoint(resolved fallbacks are cached)
          * 
+         * @param s 
          * @param codepoint 
+         * @param index The glyph index in the face
          * @return Face* 
          */
-        Face  *get_face(char32_t codepoint);
-
+        Face  *get_face(Shard &s,char32_t codepoint,Uint *index);
         /**
-         * @brief Clear context cached glyphs in the font
+         * @brief Unregister a shard before destroying it(in the fontstash mutex)
          * 
-         * @param c 
+         * @param s 
          */
-        void clear_cache_of(Context *c);
+        void   release(Shard *s);
 
-        std::unordered_multimap<char32_t,Glyph> glyphs;
-        std::vector<int>           fallbacks;
+        std::vector<int>           fallbacks;//< Guarded by the fontstash mutex
+        std::vector<Shard*>        shards;//< Shards in all contexts,guarded by the fontstash mutex
+        CacheStats                 stats;//< Counters of released shards
         std::string                name;
         Fontstash                 *stash;
         Ref<Face>                  face;
         int                        id;
+        bool                       has_kerning = false;
+        bool                       face_taken = false;//< The face is used by a shard,others clone it
     friend class Fontstash;
     friend class Context;
 };
@@ -249,6 +508,8 @@ using FallbackQuery = std::function<Font*(char32_t )>;
 /**
  * @brief Font Resource Manager 
  * 
+ * @note Thread safe,fonts could be shared by contexts in different threads(one thread per context),
+ *       but removing a font or changing fallbacks must not race with the contexts using it
  */
 class Fontstash {
     public:
@@ -269,13 +530,84 @@ class Fontstash {
         Manager *manager() const noexcept{
             return _manager;
         }
+        /**
+         * @brief Set the callback to find a font for the codepoint not in the font and its fallbacks
+         * 
+         * @note Called by contexts in their threads,set it before drawing.The found font is added to the fallbacks
+         * 
+         * @param query 
+         */
+        void  set_fallback_query(FallbackQuery query){
+            get_fallback = std::move(query);
+        }
     private:
-        FallbackQuery    get_fallback;//< Callback for fallback
+        FallbackQuery    get_fallback;//< Callback for fallback(called by contexts in their threads)
         std::map<int,Ref<Font>> fonts; 
         Manager             *_manager;
+        std::mutex           mutex;//< Guards fonts,fallbacks and shards
+        std::atomic<uint32_t> serial{0};//< Changed when fonts removed or fallbacks changed
+    friend class Context;
     friend class Font;
 };
 
+/**
+ * @brief Inclusive range of codepoints
+ * 
+ */
+class CodepointRange {
+    public:
+        char32_t first;
+        char32_t last;
+};
+/**
+ * @brief A glyph moved by atlas compaction
+ * 
+ */
+class GlyphMove {
+    public:
+        int src_page;
+        int dst_page;
+        int src_x;
+        int src_y;
+        int dst_x;
+        int dst_y;
+        int width;
+        int height;
+};
+/**
+ * @brief A glyph placed by the layout pass
+ * 
+ */
+class RunGlyph {
+    public:
+        Glyph      *glyph;
+        float       x;//< Pen position relative to the run origin
+        uint32_t    offset;//< Byte offset of the char from the run start
+};
+/**
+ * @brief The glyphs of a string laid out once,ready for alignment and output
+ * 
+ * @note Glyph pointers are valid until the next frame or atlas reset
+ */
+class TextRun {
+    public:
+        std::vector<RunGlyph> glyphs;
+        FaceMetrics metrics;//< Metrics of the font at the run size
+        Size        size;   //< Same as measure_text
+        const char *start;  //< The string laid out
+        const char *stop;   //< Where the layout stopped(end or the missing glyph)
+        float       scale = 1;//< Screen pixels per glyph bitmap pixel(SDF glyphs are scaled)
+        bool        subpixel = false;//< Glyphs are at subpixel positions,the origin must be snapped to pixel
+        uint32_t    ticket = 0;//< Some glyphs are unresolved until poll_glyphs returns it(0 on all ready)
+
+        void clear(){
+            glyphs.clear();
+            size = {0,0};
+            scale = 1;
+            subpixel = false;
+            ticket = 0;
+        }
+};
 /**
  * @brief Handler for Error (return true means handled)
  * 
@@ -284,6 +616,7 @@ typedef bool (*ErrorHandler)(void *uptr,int error,int val);
 /**
  * @brief For managing bitmaps and atlas
  * 
+ * @note A context is used by one thread at a time,contexts in different threads could share the fontstash
  */
 class Context {
     public:
@@ -326,8 +659,38 @@ class Context {
         void set_spacing(float spacing){
             states.top().spacing = spacing;
         }
+        /**
+         * @brief Set the blur radius
+         * 
+         * @note Clamped to [0,FONS_MAX_BLUR],blurred glyphs are padded by the radius
+         * 
+         * @param blur 
+         */
         void set_blur(float blur){
-            states.top().blur = blur;
+            int iblur = blur;
+            states.top().blur = iblur < 0 ? 0 : (iblur > FONS_MAX_BLUR ? FONS_MAX_BLUR : iblur);
+        }
+        /**
+         * @brief Use signed distance field glyphs
+         * 
+         * @note Glyphs are cached once at FONS_SDF_SIZE and scaled to the size(not limited by FONS_MAX_FONT_SIZE),
+         *       the renderer must decode the distance field(see Vertex::sdf_scale),blur is ignored
+         * 
+         * @param enable 
+         */
+        void set_sdf(bool enable){
+            states.top().sdf = enable;
+        }
+        /**
+         * @brief Place glyphs at subpixel positions by fractional advances
+         * 
+         * @note Each glyph has up to FONS_SUBPIXEL_LEVELS bitmaps(only for size <= FONS_SUBPIXEL_MAX_SIZE),
+         *       the x of the text is rounded to pixel
+         * 
+         * @param enable 
+         */
+        void set_subpixel(bool enable){
+            states.top().subpixel = enable;
         }
         /**
          * @brief Set the align object
@@ -342,6 +705,70 @@ class Context {
         void set_color(Color color){
             states.top().color = color;
         }
+        /**
+         * @brief Set the number of threads rasterizing the missing glyphs of a run
+         * 
+         * @note The atlas rects of the missing glyphs are reserved by the layout,then they are rasterized in parallel
+         *       (each worker has its own clones of faces) and the dirty rect is merged once.
+         *       0 or 1 means rasterizing in the calling thread one by one
+         * 
+         * @param n The number of threads(the calling thread included)
+         */
+        void set_raster_threads(int n);
+        /**
+         * @brief Rasterize the missing glyphs in a background thread
+         * 
+         * @note Layout reserves the atlas rects and doesn't wait for the bitmaps,the glyphs are unresolved
+         *       (Glyph::ticket) until poll_glyphs copies them into the atlas.TextRenderer skips them or draws
+         *       a placeholder,so the runs with TextRun::ticket (see last_ticket) need a redraw later.
+         *       Disabling waits for the queued glyphs,the raster threads are not used in async mode
+         * 
+         * @param enable 
+         */
+        void set_async(bool enable);
+        /**
+         * @brief Copy the glyphs rasterized in background into the atlas(called by layout and TextRenderer)
+         * 
+         * @return uint32_t The last resolved ticket,runs with ticket in (0,it] are ready to redraw
+         */
+        uint32_t poll_glyphs();
+        /**
+         * @brief Wait for all queued glyphs and copy them into the atlas
+         * 
+         * @return uint32_t The last resolved ticket
+         */
+        uint32_t wait_glyphs();
+        /**
+         * @brief Rasterize the glyphs of codepoint ranges at sizes ahead of drawing
+         * 
+         * @note Current font,blur,sdf and subpixel state are used(all subpixel positions if enabled),
+         *       codepoints not in the font or fallbacks are skipped.The new glyphs are packed tallest first,
+         *       then rasterized by the raster threads or in background in async mode(see wait_glyphs)
+         * 
+         * @param ranges 
+         * @param nranges 
+         * @param sizes 
+         * @param nsizes 
+         * @return int The number of glyphs added into atlas(stopped at atlas or glyph cache full,0 if the handler reset the atlas)
+         */
+        int  prewarm(const CodepointRange *ranges,size_t nranges,const float *sizes,size_t nsizes);
+        /**
+         * @brief Get the ticket of the last laid out text
+         * 
+         * @return uint32_t 0 on all glyphs are ready
+         */
+        uint32_t last_ticket() const noexcept{
+            return run.ticket;
+        }
+        /**
+         * @brief Mark the end of a frame
+         * 
+         * @note Glyphs used in the current frame will not be evicted from the cache
+         */
+        void next_frame(){
+            generation++;
+            run_serial++;
+        }
         /**
          * @brief Expand the atlas to fit the new size(if size is smaller than current size,it is no-op)
          * 
@@ -357,39 +784,101 @@ class Context {
          */
         void reset_atlas(int width,int height);
         /**
-         * @brief Get the size of the atlas
+         * @brief Repack all cached glyphs into a fresh layout,the released space will be reclaimed
+         * 
+         * @note Quads / Vertices got before this call are invalid
+         * 
+         * @param moves The moved glyphs (nullptr on no need)
+         * @return true On success(the whole used area is marked dirty)
+         * @return false Glyphs could not be repacked,nothing changed
+         */
+        bool compact_atlas(std::vector<GlyphMove> *moves = nullptr);
+        /**
+         * @brief Add a new atlas page with the same size as others
+         * 
+         * @return true On success
+         * @return false FONS_MAX_ATLAS_PAGES reached
+         */
+        bool add_atlas_page();
+        /**
+         * @brief Save the atlas pages and cached glyphs into a file
+         * 
+         * @note Glyphs are keyed on the font file hash,face index,load flags,style and dpi of their fonts,
+         *       the file is only valid for the same pixel format(FONS_CLEARTYPE)
+         * 
+         * @param path 
+         * @return true On success
+         */
+        bool save_cache(const char *path);
+        /**
+         * @brief Replace the atlas by a file of save_cache(mapped by MapFile,no glyph is rasterized)
+         * 
+         * @note Glyphs of fonts not in the fontstash or changed since saved are dropped,their space is released.
+         *       All pages are marked dirty,the atlas size may be changed
+         * 
+         * @param path 
+         * @return true On success
+         * @return false Missing,broken or other version file(nothing changed)
+         */
+        bool load_cache(const char *path);
+        /**
+         * @brief Get the number of atlas pages
+         * 
+         * @return int 
+         */
+        int  atlas_pages() const noexcept{
+            return int(pages.size());
+        }
+        /**
+         * @brief Get the size of the atlas(each page has the same size)
          * 
          * @param w The pointer of width
          * @param h The pointer of height
          */
         void get_atlas_size(int *width,int *height);
         /**
-         * @brief Get the data of the bitmap
+         * @brief Get the data of the bitmap of the first page
          * 
          * @param w The pointer of width
          * @param h The pointer of height
          * @return void* The bitmap data
          */
         void *get_data(int *w,int *h){
+            return get_data(0,w,h);
+        }
+        /**
+         * @brief Get the data of the bitmap of the page
+         * 
+         * @param page The page index
+         * @param w The pointer of width
+         * @param h The pointer of height
+         * @return void* The bitmap data
+         */
+        void *get_data(int page,int *w,int *h){
             if(w != nullptr){
                 *w = bitmap_w;
             }
             if(h != nullptr){
                 *h = bitmap_h;
             }
-            return bitmap.data();
+            return pages[page]->bitmap.data();
         }
         /**
-         * @brief Check has dirty rect?
+         * @brief Check has dirty rect in any page?
          * 
          * @return true 
          * @return false 
          */
         bool has_dirty() const noexcept{
-            return dirty_rect[0] < dirty_rect[2] && dirty_rect[1] < dirty_rect[3];
+            for(auto &page : pages){
+                if(page->has_dirty()){
+                    return true;
+                }
+            }
+            return false;
         }
         /**
-         * @brief Receive and Clear the dirty rect
+         * @brief Receive and Clear the dirty rect of the first page
          * 
          * @note The dirty rect is minx,miny,maxx,maxy from [0] to [3]
          * 
@@ -398,7 +887,19 @@ class Context {
          * @return true On has dirty rect
          * @return false No dirty rect
          */
-        bool  validate(int *dirty);
+        bool  validate(int *dirty){
+            return validate(0,dirty);
+        }
+        /**
+         * @brief Receive and Clear the dirty rect of the page
+         * 
+         * @param page The page index
+         * @param dirty The pointer of dirty rect(could not be nullptr)
+         * 
+         * @return true On has dirty rect
+         * @return false No dirty rect
+         */
+        bool  validate(int page,int *dirty);
         /**
          * @brief Get the size of the given string
          * 
@@ -407,6 +908,17 @@ class Context {
          * @return Size 
          */
         Size  measure_text(const char *text,const char *end = nullptr);
+        /**
+         * @brief Lay out the string by current state in a single pass
+         * 
+         * @param text The UTF8 string begin
+         * @param end The UTF8 string end(nullptr on null terminated string)
+         * @param bitmapOption The FONS_GLYPH_BITMAP_XXX flags for the glyphs
+         * @param run The output run(stop at the first missing glyph)
+         * @return true On success
+         * @return false No font
+         */
+        bool  layout_text(const char *text,const char *end,int bitmapOption,TextRun &run);
         /**
          * @brief Get Bounds of the given string
          * 
@@ -475,6 +987,8 @@ class Context {
             int blur = 0;
             float spacing = 0;
             float size = 12;
+            bool sdf = false;
+            bool subpixel = false;
             Color color = {};
         };
         // Atlas based on Skyline Bin Packer by Jukka Jylänki
@@ -484,6 +998,13 @@ class Context {
             short y = 0;
             short width = 0;
         };
+        // Released glyph rect,reused before the skyline
+        struct AtlasRect {
+            short x = 0;
+            short y = 0;
+            short width = 0;
+            short height = 0;
+        };
         struct Atlas {
             Atlas(Manager *manager,int w,int h);
             ~Atlas();
@@ -493,27 +1014,124 @@ class Context {
             AtlasNode* nodes;
             int nnodes;
             int cnodes;
-
+            std::vector<AtlasRect> free_rects;
 
             void reset(int width,int height);
             void expend(int width,int height);
+            void swap(Atlas &other);
             void remove_node(int index);
             bool insert_node(int index,int x,int width,int height);
             bool add_skyline(int index,int x,int y,int w,int h);
             int  rect_fits(int i,int w,int h);
             bool add_rect(int x,int y,int *w,int *h);
+            bool reuse_rect(int w,int h,int *x,int *y);
+            void free_rect(int x,int y,int w,int h);
+            int  free_area() const;
+        };
+        struct RasterPool;
+        struct AsyncLoader;
+        struct Page {
+            Page(Manager *manager,int w,int h);
+
+            Atlas              atlas;
+            std::vector<Pixel> bitmap;
+            int                dirty_rect[4];
+
+            bool has_dirty() const noexcept{
+                return dirty_rect[0] < dirty_rect[2] && dirty_rect[1] < dirty_rect[3];
+            }
+            void mark_dirty(int x,int y,int w,int h);
+            void clear_dirty();
         };
         bool handle_atlas_full();
+        /**
+         * @brief Alloc a rect in atlas pages(call the error handler on full)
+         * 
+         * @note The handler may reset the atlas(see reset_serial),then the glyphs got before are gone
+         * @param w 
+         * @param h 
+         * @param page The page of the rect
+         * @param x 
+         * @param y 
+         * @return true On success
+         */
+        bool alloc_rect(int w,int h,int *page,int *x,int *y);
+        int  free_area() const;
+        /**
+         * @brief Lay out the string once(see layout_text,which retries it on the atlas reset)
+         * 
+         */
+        bool layout_once(const char *text,const char *end,int bitmapOption,TextRun &run);
+        /**
+         * @brief Rasterize a glyph into its rect in atlas(dirty rect is not marked)
+         * 
+         * @note Different glyphs could be rasterized in parallel with different faces
+         * @param g The glyph with rect
+         * @param face The face of the glyph or a clone of it
+         */
+        void raster_glyph(Glyph *g,Face *face);
+        /**
+         * @brief Rasterize the glyphs reserved by FONS_GLYPH_BITMAP_DEFERRED,by the pool if there are enough
+         * 
+         * @note In async mode they are queued to the loader as a new ticket
+         * 
+         * @return uint32_t The ticket of the queued glyphs(0 on rasterized now)
+         */
+        uint32_t raster_pending();
+        /**
+         * @brief Merge the rects of glyphs into the dirty rect of each page
+         * 
+         * @param glyphs 
+         */
+        void mark_dirty(const std::vector<Glyph*> &glyphs);
+        /**
+         * @brief Get the solid glyph for drawing unresolved glyphs(allocated in atlas on first use)
+         * 
+         * @return Glyph* (nullptr on no space)
+         */
+        Glyph *placeholder_glyph();
+        /**
+         * @brief Get the font by id for this context(shards of fonts removed from fontstash are released first)
+         * 
+         * @param id 
+         * @return Font* (nullptr on not found)
+         */
+        Font *font_of(int id);
+        /**
+         * @brief Get the state of the font in this context(created on first use)
+         * 
+         * @param font 
+         * @return Font::Shard* 
+         */
+        Font::Shard *shard_of(Font *font);
+        /**
+         * @brief Release all shards(glyphs,caches and faces of fonts in this context)
+         * 
+         */
+        void release_shards();
 
         std::set<Ref<Font>>     fonts;
-        std::vector<Pixel>      bitmap;
         std::stack<State>       states;
-        Atlas                   atlas;
         Fontstash              *stash;
-        //Bitmap
+        //Font states of this context,keyed on font id
+        std::unordered_map<int,std::unique_ptr<Font::Shard>> shards;
+        Font::Shard            *last_shard = nullptr;//< The last one got by shard_of
+        uint32_t                font_serial = 0;//< The serial of fontstash seen by font_of
+        //Parallel rasterization
+        std::unique_ptr<RasterPool> pool;//< nullptr on rasterizing in the calling thread
+        std::vector<Glyph*>     pending;//< Glyphs with reserved rects but no bitmap
+        std::unique_ptr<AsyncLoader> loader;//< nullptr on synchronous rasterization
+        //Bitmap pages
+        std::vector<std::unique_ptr<Page>> pages;
         int                     bitmap_w;
         int                     bitmap_h;
-        int                     dirty_rect[4];
+        uint32_t                generation = 0;
+        //Scratch runs for layout and TextIter
+        TextRun                 run;
+        TextRun                 iter_run;
+        uint32_t                run_serial = 0;//< Changed when iter_run is invalid
+        uint32_t                atlas_epoch = 0;//< Changed when glyphs are moved or removed
+        uint32_t                reset_serial = 0;//< Changed when the glyph caches are cleared(pointers to glyphs are invalid)
         //Error handler
         ErrorHandler            handler;
         void                   *user;
@@ -525,6 +1143,7 @@ class Context {
 class Vertex {
     public:
         //< Glyph in bitmap
+        int page;
         int glyph_w;
         int glyph_h;
         int glyph_x;
@@ -536,6 +1155,23 @@ class Vertex {
         float screen_h;
 
         Color c;//< Color
+        float sdf_scale;//< Screen pixels per bitmap pixel of a SDF glyph(0 on coverage glyph)
+};
+
+/**
+ * @brief Glyph quads ready to upload,same arrays as FONSparams renderDraw
+ * 
+ * @note Each glyph is 4 vertices (x0,y0) (x1,y0) (x1,y1) (x0,y1),drawn by 6 indices
+ */
+class DrawBatch {
+    public:
+        const float    *verts;   //< x,y of each vertex
+        const float    *tcoords; //< s,t of each vertex(normalized to [0,1])
+        const uint32_t *colors;  //< R,G,B,A bytes of each vertex
+        const uint32_t *indices; //< 0,1,2,0,2,3 + 4 * quad,shared by all batches
+        int             page;    //< The atlas page of all glyphs
+        int             nverts;
+        int             nindices;
 };
 
 /**
@@ -558,14 +1194,25 @@ class TextRenderer : protected Context {
         using Context::set_size;
         using Context::set_spacing;
         using Context::set_blur;
+        using Context::set_subpixel;
         using Context::set_align;
         using Context::set_color;
+        using Context::set_raster_threads;
+        using Context::set_async;
+        using Context::poll_glyphs;
+        using Context::wait_glyphs;
+        using Context::last_ticket;
+        using Context::prewarm;
 
         //Using measure
         using Context::measure_text;
         using Context::vert_metrics;
         using Context::line_bounds;
 
+        /**
+         * @brief Draw the pending vertices and begin a new frame
+         * 
+         */
         void flush();
         void draw_text(float x,float y,const char *text,const char *end = nullptr);
         void draw_vtext(float x,float y,const char *fmt,...);
@@ -573,6 +1220,37 @@ class TextRenderer : protected Context {
         //Atlas operations
         void expand(int width,int height);
         void reset(int width,int height);
+        bool compact();
+        bool load_cache(const char *path);
+        using Context::save_cache;
+
+        /**
+         * @brief Cache the laid out vertices of strings for repeated draw_text
+         * 
+         * @note Keyed on the string,font,size,spacing and blur,invalidated when the atlas changes
+         * 
+         * @param max_runs The max number of cached runs(0 to disable,default)
+         */
+        void set_run_cache(size_t max_runs);
+        /**
+         * @brief Draw a solid box for glyphs still rasterizing in background instead of nothing
+         * 
+         * @param enable 
+         */
+        void set_placeholder(bool enable){
+            placeholder = enable;
+        }
+        /**
+         * @brief Use signed distance field glyphs(see Context::set_sdf)
+         * 
+         * @note Asserted on renderers can't decode the distance field,coverage glyphs are used there
+         * 
+         * @param enable 
+         */
+        void set_sdf(bool enable){
+            LILIM_ASSERT(!enable || sdf_support);
+            Context::set_sdf(enable && sdf_support);
+        }
 
         Size atlas_size(){
             int w,h;
@@ -583,14 +1261,17 @@ class TextRenderer : protected Context {
         /**
          * @brief Update the dirty rect
          * 
+         * @note A page index never seen before means a new page was added
+         * 
+         * @param page The page index
          * @param x 
          * @param y 
          * @param w 
          * @param h 
          */
-        virtual void render_update(int x,int y,int w,int h) = 0;
+        virtual void render_update(int page,int x,int y,int w,int h) = 0;
         /**
-         * @brief Resize the device texture
+         * @brief Resize the device textures of all pages
          * 
          * @param w 
          * @param h 
@@ -608,10 +1289,79 @@ class TextRenderer : protected Context {
          * 
          */
         virtual void render_flush() = 0;
+        /**
+         * @brief Draw the quads of glyphs in a page(only in batch output mode)
+         * 
+         * @note Called once for each run of glyphs in the same page,before render_flush
+         * 
+         * @param batch 
+         */
+        virtual void render_batch(const DrawBatch &batch);
+        /**
+         * @brief Output DrawBatch by render_batch instead of render_draw
+         * 
+         * @param enable 
+         */
+        void set_batch_output(bool enable){
+            batch_output = enable;
+        }
+        /**
+         * @brief Limit the page size when growing the atlas(e.g. by the max texture size)
+         * 
+         * @note FONS_ATLAS_FULL is reported after it is reached with all pages
+         * 
+         * @param size Clamped to FONS_MAX_ATLAS_SIZE
+         */
+        void set_max_atlas_size(int size){
+            max_atlas_size = std::min(size,FONS_MAX_ATLAS_SIZE);
+        }
+        /**
+         * @brief Tell whether render_draw decodes SDF glyphs(Vertex::sdf_scale),default true
+         * 
+         * @param support 
+         */
+        void set_sdf_support(bool support){
+            sdf_support = support;
+        }
     private:
+        /**
+         * @brief A laid out string with vertices relative to the origin
+         * 
+         */
+        struct CachedRun {
+            std::string          text;
+            Ref<Font>            font;//< Hold it,so the pointer is never reused
+            float                size;
+            float                spacing;
+            int                  blur;
+            bool                 sdf;
+            bool                 subpixel;
+            uint32_t             epoch;     //< atlas_epoch on built
+            uint32_t             generation;//< The frame generation of last use
+            Size                 extent;
+            FaceMetrics          metrics;
+            std::vector<Glyph*>  glyphs;
+            std::vector<Vertex>  vertices;
+        };
         void add_vert(const Vertex &vert);
+        void submit();
+        void emit_run(float x,float y,std::vector<Vertex> &out);
+        void draw_cached(float x,float y,const char *str,const char *end);
+        void submit_batches();
 
         std::vector<Vertex> vertices;
+        //Batch output
+        bool                  batch_output = false;
+        std::vector<float>    batch_verts;
+        std::vector<float>    batch_tcoords;
+        std::vector<uint32_t> batch_colors;
+        std::vector<uint32_t> quad_indices;
+        //Cached runs by hash
+        std::unordered_map<uint64_t,CachedRun> runs;
+        size_t max_runs = 0;
+        bool   placeholder = false;
+        int    max_atlas_size = FONS_MAX_ATLAS_SIZE;
+        bool   sdf_support = true;
         //Buffer for draw_vfmt
         char  *text_buffer = nullptr;
         size_t text_length = 0;
@@ -629,6 +1379,8 @@ class Quad {
     public:
         float x0,y0,s0,t0;
         float x1,y1,s1,t1;
+        int   page;//< The atlas page of the texture
+        float sdf_scale;//< Screen pixels per bitmap pixel of a SDF glyph(0 on coverage glyph)
 
 };
 /**
@@ -640,16 +1392,22 @@ class TextIter {
         float x, y, nextx, nexty, scale, spacing;
         unsigned int codepoint;
         
-        short isize, iblur;
+        short isize, iblur, iflags;
+        bool subpixel;//< Glyphs at subpixel positions
 
         Font *font;
         int64_t prevGlyphIndex;//< I think int64 is better than int
-        const char* str;
-        const char* next;
+        const char* str;//< After the last glyph,where the next one starts
+        const char* next;//< Start of the last glyph
         const char* end;
         unsigned int utf8state;
         int bitmapOption;
 
+        //Laid out run in context
+        float originx;
+        size_t runIndex;
+        uint32_t runSerial;
+
         //Text Height / Width
         float width;
         float height;
@@ -673,6 +1431,37 @@ void TransformByAlign(
     FaceMetrics m
 );
 
+//Inline implement
+template<class Fn>
+void GlyphCache::for_each(Fn &&fn){
+    for(auto &slot : slots){
+        if(slot.index != 0){
+            fn(storage[slot.index - 1]);
+        }
+    }
+}
+template<class Fn>
+void GlyphCache::erase_if(Fn &&pred){
+    //Rebuild the table with the survivors
+    std::vector<Slot> old(slots.size(),Slot{0,0});
+    old.swap(slots);
+    count = 0;
+    for(auto &slot : old){
+        if(slot.index == 0){
+            continue;
+        }
+        Glyph &glyph = storage[slot.index - 1];
+        if(pred(glyph)){
+            //Don't keep the face alive until reused
+            glyph = Glyph();
+            free_list.push_back(slot.index - 1);
+            continue;
+        }
+        place(slot.hash,slot.index);
+        count++;
+    }
+}
+
 FONS_NS_END
 
 //Inline Wrap for C
@@ -708,6 +1497,12 @@ using FONSquad    = FONS_NAMESPACE::Quad;
 #define fonsSetSize(X,SIZE) X->set_size(SIZE)
 #define fonsSetFont(X,ID) X->set_font(ID)
 #define fonsSetBlur(X,BLUR) X->set_blur(BLUR)
+#define fonsSetSDF(X,SDF) X->set_sdf(SDF)
+#define fonsSetSubpixel(X,SUBPIXEL) X->set_subpixel(SUBPIXEL)
+#define fonsSetRasterThreads(X,N) X->set_raster_threads(N)
+#define fonsSetAsync(X,ASYNC) X->set_async(ASYNC)
+#define fonsPollGlyphs(X) X->poll_glyphs()
+#define fonsPrewarm(X,RANGES,NRANGES,SIZES,NSIZES) X->prewarm((const FONS_NAMESPACE::CodepointRange*)(RANGES),NRANGES,SIZES,NSIZES)
 #define fonsSetSpacing(X,SPACING) X->set_spacing(SPACING)
 #define fonsSetAlign(X,ALIGN) X->set_align(ALIGN)
 
@@ -738,6 +1533,8 @@ using FONSquad    = FONS_NAMESPACE::Quad;
 
 //Atlas
 #define fonsExpandAtlas(S,W,H) S->expand_atlas(W,H)
+#define fonsSaveAtlasCache(S,PATH) S->save_cache(PATH)
+#define fonsLoadAtlasCache(S,PATH) S->load_cache(PATH)
 
 #else
 
@@ -759,6 +1556,13 @@ FONS_CAPI(void         ) fonsSetSpacing(FONScontext *s,float spacing);
 FONS_CAPI(void         ) fonsSetSize(FONScontext *s,float size);
 FONS_CAPI(void         ) fonsSetFont(FONScontext *s,int font);
 FONS_CAPI(void         ) fonsSetBlur(FONScontext *s,int blur);
+FONS_CAPI(void         ) fonsSetSDF(FONScontext *s,int sdf);
+FONS_CAPI(void         ) fonsSetSubpixel(FONScontext *s,int subpixel);
+FONS_CAPI(void         ) fonsSetRasterThreads(FONScontext *s,int n);
+FONS_CAPI(void         ) fonsSetAsync(FONScontext *s,int async);
+FONS_CAPI(unsigned int ) fonsPollGlyphs(FONScontext *s);
+//Ranges are pairs of first,last codepoints
+FONS_CAPI(int          ) fonsPrewarm(FONScontext *s,const unsigned int *ranges,int nranges,const float *sizes,int nsizes);
 FONS_CAPI(void         ) fonsSetAlign(FONScontext *s,int align);
 
 // States Manage
@@ -789,5 +1593,7 @@ FONS_CAPI(int          ) fonsTextIterNext(FONScontext *s,FONStextIter* iter,FONS
 // Atlas
 FONS_CAPI(void         ) fonsExpandAtlas(FONScontext *s,int width,int height);
 FONS_CAPI(void         ) fonsResetAtlas(FONScontext *s,int width,int height);
+FONS_CAPI(int          ) fonsSaveAtlasCache(FONScontext *s,const char *path);
+FONS_CAPI(int          ) fonsLoadAtlasCache(FONScontext *s,const char *path);
 
 #endif
\ No newline at end of file
@@ -14,6 +14,26 @@
     #include <fcntl.h>
 #endif
 
+//SIMD for UTF8 decoding
+#if !defined(LILIM_NO_SIMD)
+    #if defined(__AVX2__)
+        #include <immintrin.h>
+        #define LILIM_AVX2
+        #define LILIM_SSE2
+    #elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+        #include <emmintrin.h>
+        #define LILIM_SSE2
+    #endif
+    #if defined(LILIM_SSE2) && defined(_MSC_VER)
+        #include <intrin.h>
+    #endif
+#endif
+
+//FreeType sdf renderer(added in 2.11)
+#if !defined(LILIM_STBTRUETYPE) && (FREETYPE_MAJOR > 2 || (FREETYPE_MAJOR == 2 && FREETYPE_MINOR >= 11))
+    #define LILIM_FT_SDF
+#endif
+
 //Stb truetype includes
 #ifdef LILIM_STBTRUETYPE
     #define STB_TRUETYPE_IMPLEMENTATION
@@ -63,6 +83,12 @@ Manager::Manager(){
         //TODO: Error handling
         std::abort();
     }
+#ifdef LILIM_FT_SDF
+    //Same padding as stb_truetype backend
+    FT_UInt spread = LILIM_SDF_SPREAD;
+    FT_Property_Set(library,"sdf","spread",&spread);
+    FT_Property_Set(library,"bsdf","spread",&spread);
+#endif
 }
 Manager::~Manager(){
     FT_Done_FreeType(library);
@@ -73,6 +99,7 @@ Ref<Face> Manager::new_face(Ref<Blob> blob,int index){
     FT_Bytes bytes = static_cast<FT_Bytes>(blob->data());
     FT_Long  size  = static_cast<FT_Long>(blob->size());
     FT_Face  face;
+    std::lock_guard<std::mutex> lock(mutex);
     if(FT_New_Memory_Face(library,bytes,size,index,&face)){
         //Failed to load font
         return {};
@@ -81,6 +108,7 @@ Ref<Face> Manager::new_face(Ref<Blob> blob,int index){
     ret->manager = this;
     ret->blob    = blob;
     ret->face    = face;
+    ret->base    = face->size;
     ret->idx     = index;
     return ret;
 }
@@ -138,15 +166,31 @@ Face::Face(){
     flags = FT_LOAD_FORCE_AUTOHINT | FT_LOAD_TARGET_LIGHT;
     manager = nullptr;
     face    = nullptr;
+    scales  = nullptr;
+    nscales = 0;
+    cscales = 0;
+    cmap_blocks   = nullptr;
+    cmap_table    = nullptr;
+    cmap_count    = 0;
+    cmap_capacity = 0;
+    base    = nullptr;
+    loaded  = ~Uint(0);
     styles  = 0;
+    shift   = 0;
     xdpi    = 0;
     ydpi    = 0;
     idx     = 0;
 }
 Face::~Face(){
+    //Sizes are released by FT_Done_Face
+    manager->free(scales);
+    clear_cmap();
+    std::lock_guard<std::mutex> lock(manager->mutex);
     FT_Done_Face(face);
 }
 void  Face::set_size(FaceSize size){
+    //Don't touch the cached sizes
+    FT_Activate_Size(base);
     FT_Set_Char_Size(
         face,
         size.width * 64,
@@ -154,17 +198,27 @@ void  Face::set_size(FaceSize size){
         size.xdpi,
         size.ydpi
     );
+    loaded = ~Uint(0);
 }
 void  Face::set_size(Uint size){
-    FT_Set_Char_Size(
-        face,
-        0,
-        size * 64,
-        xdpi,
-        ydpi
-    );
+    FT_Size handle = scale_of(size)->handle;
+    if(face->size != handle){
+        FT_Activate_Size(handle);
+        loaded = ~Uint(0);
+    }
 }
-Uint  Face::glyph_index(char32_t codepoint){
+void  Face::set_subpixel(float x){
+    int s = x * 64;
+    if(s == shift){
+        return;
+    }
+    //Outlines are translated after hinting on loading
+    shift = s;
+    FT_Vector delta = {s,0};
+    FT_Set_Transform(face,nullptr,&delta);
+    loaded = ~Uint(0);
+}
+Uint  Face::find_glyph_index(char32_t codepoint){
     return FT_Get_Char_Index(face,codepoint);
 }
 Int   Face::kerning(Uint prev,Uint cur){
@@ -177,32 +231,77 @@ Int   Face::kerning(Uint prev,Uint cur){
     }
     return delta.x >> 6;
 }
-auto  Face::metrics() -> FaceMetrics{
+Int   Face::kerning(Uint size,Uint prev,Uint cur){
+    if(!FT_HAS_KERNING(face)){
+        return 0;
+    }
+    FT_Vector delta;
+    FT_Error err;
+    err = FT_Get_Kerning(face,prev,cur,FT_KERNING_UNSCALED,&delta);
+    if(err){
+        //Error
+        std::abort();
+    }
+    //Same as FT_KERNING_DEFAULT,but scaled by the cached size
+    const FT_Size_Metrics &m = scale_of(size)->handle->metrics;
+    FT_Pos x = FT_MulFix(delta.x,m.x_scale);
+    if(m.x_ppem < 25){
+        x = FT_MulDiv(x,m.x_ppem,25);
+    }
+    x = (x + 32) & -64;
+    return x >> 6;
+}
+bool  Face::has_kerning(){
+    return FT_HAS_KERNING(face);
+}
+int   Face::kerning_pairs(KerningPair *pairs,int n){
+    //Not supported by freetype
+    LILIM_UNUSED(pairs);
+    LILIM_UNUSED(n);
+    return 0;
+}
+static FaceMetrics MetricsOf(FT_Face face,const FT_Size_Metrics &size){
     FaceMetrics metrics;
     if(FT_IS_SCALABLE(face)){
-        FT_Fixed scale = face->size->metrics.y_scale;
+        FT_Fixed scale = size.y_scale;
         metrics.ascender   = FixedCeil(FT_MulFix(face->ascender, scale));
         metrics.descender  = FixedCeil(FT_MulFix(face->descender, scale));
         metrics.height   = FixedCeil(FT_MulFix(face->ascender - face->descender, scale));
         metrics.underline_position = FixedFloor(FT_MulFix(face->underline_position, scale));
         metrics.underline_thickness = FixedFloor(FT_MulFix(face->underline_thickness, scale));
-        metrics.max_advance = face->size->metrics.max_advance >> 6;
+        metrics.max_advance = size.max_advance >> 6;
     }
     else{
-        metrics.ascender    = face->size->metrics.ascender >> 6;
-        metrics.descender   = face->size->metrics.descender >> 6;
-        metrics.height      = face->size->metrics.height >> 6;
-        metrics.max_advance = face->size->metrics.max_advance >> 6;
+        metrics.ascender    = size.ascender >> 6;
+        metrics.descender   = size.descender >> 6;
+        metrics.height      = size.height >> 6;
+        metrics.max_advance = size.max_advance >> 6;
         metrics.underline_position = face->underline_position >> 6;
         metrics.underline_thickness = face->underline_thickness >> 6;
     }
     return metrics;
 }
-auto  Face::build_glyph(Uint code) -> GlyphMetrics{
+auto  Face::metrics() -> FaceMetrics{
+    return MetricsOf(face,face->size->metrics);
+}
+auto  Face::metrics(Uint size) -> FaceMetrics{
+    return MetricsOf(face,scale_of(size)->handle->metrics);
+}
+void  Face::load_glyph(Uint code,bool outline){
+    if(code == loaded){
+        if(!outline || face->glyph->format != FT_GLYPH_FORMAT_BITMAP){
+            return;
+        }
+    }
     if(FT_Load_Glyph(face,code,flags)){
         //Error
         std::abort();
     }
+    loaded = code;
+}
+auto  Face::build_glyph(Uint code) -> GlyphMetrics{
+    //The preset bitmap of outline is the same as the rendered one
+    load_glyph(code);
     FT_GlyphSlot slot = face->glyph;
     GlyphMetrics ret;
 
@@ -212,6 +311,7 @@ auto  Face::build_glyph(Uint code) -> GlyphMetrics{
     ret.bitmap_left = slot->bitmap_left;
     ret.bitmap_top  = slot->bitmap_top;
     ret.advance_x   = slot->advance.x >> 6;
+    ret.advance_x64 = slot->linearHoriAdvance ? slot->linearHoriAdvance >> 10 : slot->advance.x;
 
     //LCD mode
     if((flags & FT_LOAD_TARGET_LCD) == FT_LOAD_TARGET_LCD){
@@ -222,10 +322,18 @@ auto  Face::build_glyph(Uint code) -> GlyphMetrics{
     return ret;
 }
 void  Face::render_glyph(Uint code,void *b,int pitch,int pen_x,int pen_y){
-    if(FT_Load_Glyph(face,code,FT_LOAD_RENDER | flags)){
-        std::abort();
-    }
+    //Reuse the glyph loaded by build_glyph,same as FT_LOAD_RENDER
+    load_glyph(code);
     FT_GlyphSlot slot = face->glyph;
+    if(slot->format != FT_GLYPH_FORMAT_BITMAP){
+        FT_Render_Mode mode = FT_Render_Mode(FT_LOAD_TARGET_MODE(flags));
+        if(flags & FT_LOAD_MONOCHROME){
+            mode = FT_RENDER_MODE_MONO;
+        }
+        if(FT_Render_Glyph(slot,mode)){
+            std::abort();
+        }
+    }
     //Begin rendering
     //TODO : Handle pitch and Format
 
@@ -276,20 +384,126 @@ void  Face::render_glyph(Uint code,void *b,int pitch,int pen_x,int pen_y){
             LILIM_ASSERT(false);
     }
 }
+bool  Face::render_outline(Uint code,void *b,int pitch,int width,int height,int x,int y){
+    if(pixel_bytes() != 1){
+        return false;
+    }
+    load_glyph(code,true);
+    FT_GlyphSlot slot = face->glyph;
+    if(slot->format != FT_GLYPH_FORMAT_OUTLINE){
+        return false;
+    }
+    //The outline is moved,load it again next time
+    loaded = ~Uint(0);
+    //Same offset as the smooth renderer(by the preset bitmap),bottom of buffer is y = 0
+    FT_Outline_Translate(
+        &slot->outline,
+        (x - slot->bitmap_left) * 64,
+        (height - y - slot->bitmap_top) * 64
+    );
+    FT_Bitmap bitmap = {};
+    bitmap.buffer     = static_cast<uint8_t*>(b);
+    bitmap.width      = width;
+    bitmap.rows       = height;
+    bitmap.pitch      = pitch;
+    bitmap.pixel_mode = FT_PIXEL_MODE_GRAY;
+    bitmap.num_grays  = 256;
+    return FT_Outline_Get_Bitmap(manager->native_handle(),&slot->outline,&bitmap) == 0;
+}
+auto  Face::build_sdf_glyph(Uint code) -> GlyphMetrics{
+#ifdef LILIM_FT_SDF
+    load_glyph(code,true);
+    FT_GlyphSlot slot = face->glyph;
+    GlyphMetrics ret;
+    ret.advance_x   = slot->advance.x >> 6;
+    ret.advance_x64 = slot->linearHoriAdvance ? slot->linearHoriAdvance >> 10 : slot->advance.x;
+
+    if(slot->format != FT_GLYPH_FORMAT_OUTLINE){
+        //Bitmap glyph(by bsdf),the size is known after rendering
+        loaded = ~Uint(0);
+        if(FT_Render_Glyph(slot,FT_RENDER_MODE_SDF)){
+            ret.width  = 0;
+            ret.height = 0;
+            ret.bitmap_left = 0;
+            ret.bitmap_top  = 0;
+            return ret;
+        }
+        ret.width  = slot->bitmap.width;
+        ret.height = slot->bitmap.rows;
+        ret.bitmap_left = slot->bitmap_left;
+        ret.bitmap_top  = slot->bitmap_top;
+        return ret;
+    }
+    if(slot->outline.n_points == 0){
+        //Empty glyph has no bitmap
+        ret.width  = 0;
+        ret.height = 0;
+        ret.bitmap_left = 0;
+        ret.bitmap_top  = 0;
+        return ret;
+    }
+    //Same as the sdf renderer,the pixel aligned box padded by spread
+    FT_BBox box;
+    FT_Outline_Get_CBox(&slot->outline,&box);
+    int x0 = box.xMin >> 6;
+    int y0 = box.yMin >> 6;
+    int x1 = (box.xMax + 63) >> 6;
+    int y1 = (box.yMax + 63) >> 6;
+
+    ret.width  = x1 - x0 + LILIM_SDF_SPREAD * 2;
+    ret.height = y1 - y0 + LILIM_SDF_SPREAD * 2;
+    ret.bitmap_left = x0 - LILIM_SDF_SPREAD;
+    ret.bitmap_top  = y1 + LILIM_SDF_SPREAD;
+    return ret;
+#else
+    return build_glyph(code);
+#endif
+}
+void  Face::render_sdf_glyph(Uint code,void *b,int pitch,int pen_x,int pen_y){
+#ifdef LILIM_FT_SDF
+    load_glyph(code,true);
+    FT_GlyphSlot slot = face->glyph;
+    //The slot holds the sdf bitmap after rendering
+    loaded = ~Uint(0);
+    if(FT_Render_Glyph(slot,FT_RENDER_MODE_SDF)){
+        //The sdf renderer may fail on broken outlines,keep it empty
+        return;
+    }
+    uint8_t *pixels = static_cast<uint8_t*>(b) + pen_y * pitch + pen_x;
+    uint8_t *buffer = slot->bitmap.buffer;
+    for(Uint y = 0;y < slot->bitmap.rows;y++){
+        std::memcpy(pixels,buffer,slot->bitmap.width);
+        pixels += pitch;
+        buffer += slot->bitmap.pitch;
+    }
+#else
+    render_glyph(code,b,pitch,pen_x,pen_y);
+#endif
+}
 #else
 //Stb TrueType  Face
 Face::Face(){
     flags   = 0;
     manager = nullptr;
     face    = nullptr;
+    scales  = nullptr;
+    nscales = 0;
+    cscales = 0;
+    cmap_blocks   = nullptr;
+    cmap_table    = nullptr;
+    cmap_count    = 0;
+    cmap_capacity = 0;
+    shift   = 0;
     xdpi    = 0;
     ydpi    = 0;
     idx     = 0;
 }
 Face::~Face(){
+    manager->free(scales);
+    clear_cmap();
     manager->free(face);
 }
-void  Face::set_size(FaceSize size){
+static void ScaleOf(_lilim_fontinfo *face,FaceSize size,float *x,float *y){
     //Process width / height by DPI
     size.xdpi = size.xdpi ? size.xdpi : 72;
     size.ydpi = size.ydpi ? size.ydpi : 72;
@@ -303,27 +517,73 @@ void  Face::set_size(FaceSize size){
     xscale  *= size.xdpi / 72.0f;
     yscale  *= size.ydpi / 72.0f;
 
-    face->xscale = xscale;
-    face->yscale = yscale;
+    *x = xscale;
+    *y = yscale;
+}
+void  Face::set_size(FaceSize size){
+    ScaleOf(face,size,&face->xscale,&face->yscale);
 }
 void  Face::set_size(Uint size){
-    FaceSize s;
-    s.width = size;
-    s.height = size;
-    s.xdpi = xdpi;
-    s.ydpi = ydpi;
-
-    set_size(s);
+    Scale *s = scale_of(size);
+    face->xscale = s->xscale;
+    face->yscale = s->yscale;
 }
-Uint  Face::glyph_index(char32_t codepoint){
+void  Face::set_subpixel(float x){
+    shift = x * 64;
+}
+Uint  Face::find_glyph_index(char32_t codepoint){
     return stbtt_FindGlyphIndex(face,codepoint);
 }
 Int   Face::kerning(Uint prev,Uint cur){
+#ifdef LILIM_STB_KERNING
+    return std::floor(stbtt_GetGlyphKernAdvance(face,prev,cur) * face->xscale + 0.5f);
+#else
+    LILIM_UNUSED(prev);
+    LILIM_UNUSED(cur);
     return 0;
     //FIXME : Kerning bug in big size font
-    // return stbtt_GetGlyphKernAdvance(face,prev,cur) * face->xscale;
+#endif
 }
-auto  Face::metrics() -> FaceMetrics{
+Int   Face::kerning(Uint size,Uint prev,Uint cur){
+#ifdef LILIM_STB_KERNING
+    return std::floor(stbtt_GetGlyphKernAdvance(face,prev,cur) * scale_of(size)->xscale + 0.5f);
+#else
+    LILIM_UNUSED(size);
+    return kerning(prev,cur);
+#endif
+}
+bool  Face::has_kerning(){
+#ifdef LILIM_STB_KERNING
+    return face->kern != 0 || face->gpos != 0;
+#else
+    return false;
+#endif
+}
+int   Face::kerning_pairs(KerningPair *pairs,int n){
+#ifdef LILIM_STB_KERNING
+    int len = stbtt_GetKerningTableLength(face);
+    if(pairs == nullptr || len <= 0){
+        return len;
+    }
+    len = std::min(len,n);
+    auto entries = static_cast<stbtt_kerningentry*>(
+        manager->malloc(sizeof(stbtt_kerningentry) * len)
+    );
+    len = stbtt_GetKerningTable(face,entries,len);
+    for(int i = 0;i < len;i++){
+        pairs[i].left    = entries[i].glyph1;
+        pairs[i].right   = entries[i].glyph2;
+        pairs[i].advance = entries[i].advance;
+    }
+    manager->free(entries);
+    return len;
+#else
+    LILIM_UNUSED(pairs);
+    LILIM_UNUSED(n);
+    return 0;
+#endif
+}
+static FaceMetrics MetricsOf(_lilim_fontinfo *face,float yscale){
     FaceMetrics metrics;
     //Get metrics
     int ascender;
@@ -332,14 +592,20 @@ auto  Face::metrics() -> FaceMetrics{
     stbtt_GetFontVMetrics(face,&ascender,&descender,&linegap);
     //Scale it by size
 
-    metrics.ascender    = std::ceil(ascender * face->yscale);
-    metrics.descender   = std::ceil(descender * face->yscale);
-    metrics.height      = std::ceil((ascender - descender) * face->yscale);
+    metrics.ascender    = std::ceil(ascender * yscale);
+    metrics.descender   = std::ceil(descender * yscale);
+    metrics.height      = std::ceil((ascender - descender) * yscale);
     metrics.max_advance = -1; // Not supported
     metrics.underline_position = -1; // Not supported
     metrics.underline_thickness = -1; // Not supported
     return metrics;
 }
+auto  Face::metrics() -> FaceMetrics{
+    return MetricsOf(face,face->yscale);
+}
+auto  Face::metrics(Uint size) -> FaceMetrics{
+    return MetricsOf(face,scale_of(size)->yscale);
+}
 auto  Face::build_glyph(Uint code) -> GlyphMetrics{
     GlyphMetrics ret;
     //Get metrics
@@ -348,20 +614,22 @@ auto  Face::build_glyph(Uint code) -> GlyphMetrics{
     int x0,y0,x1,y1;
 
     stbtt_GetGlyphHMetrics(face,code,&advance,&lsb);
-    stbtt_GetGlyphBitmapBox(face,code,face->xscale,face->yscale,&x0,&y0,&x1,&y1);
+    stbtt_GetGlyphBitmapBoxSubpixel(face,code,face->xscale,face->yscale,shift / 64.0f,0,&x0,&y0,&x1,&y1);
 
     ret.width  = x1 - x0;
     ret.height = y1 - y0;
     ret.bitmap_left = x0;
     ret.bitmap_top  = -y0;
     ret.advance_x   = advance * face->xscale;
+    ret.advance_x64 = std::floor(advance * face->xscale * 64 + 0.5f);
 
     return ret;
 }
 void  Face::render_glyph(Uint code,void *b,int pitch,int pen_x,int pen_y){
     int x0,y0,x1,y1;
+    float xshift = shift / 64.0f;
 
-    stbtt_GetGlyphBitmapBox(face,code,face->xscale,face->yscale,&x0,&y0,&x1,&y1);
+    stbtt_GetGlyphBitmapBoxSubpixel(face,code,face->xscale,face->yscale,xshift,0,&x0,&y0,&x1,&y1);
 
     int width  = x1 - x0;
     int height = y1 - y0;
@@ -371,7 +639,7 @@ void  Face::render_glyph(Uint code,void *b,int pitch,int pen_x,int pen_y){
     int      stride = pitch;
 
     //Rasterize
-    stbtt_MakeGlyphBitmap(
+    stbtt_MakeGlyphBitmapSubpixel(
         face,
         pixels,
         width,
@@ -379,89 +647,318 @@ void  Face::render_glyph(Uint code,void *b,int pitch,int pen_x,int pen_y){
         stride,
         face->xscale,
         face->yscale,
+        xshift,
+        0,
         code
     );
 }
-#endif
+bool  Face::render_outline(Uint,void *,int,int,int,int,int){
+    //stb_truetype could not rasterize into a clipped buffer
+    return false;
+}
+auto  Face::build_sdf_glyph(Uint code) -> GlyphMetrics{
+    GlyphMetrics ret;
+    int advance;
+    int lsb;
+    int x0,y0,x1,y1;
 
-auto  Face::measure_text(const char *text,const char *end) -> Size{
-    int w = 0;
-    int h = 0;
+    //stbtt_GetGlyphSDF has only one scale
+    stbtt_GetGlyphHMetrics(face,code,&advance,&lsb);
+    stbtt_GetGlyphBitmapBox(face,code,face->yscale,face->yscale,&x0,&y0,&x1,&y1);
 
-    const char *cur = text;
-    if(end == nullptr){
-        end = text + std::strlen(text);
+    ret.advance_x   = advance * face->xscale;
+    ret.advance_x64 = std::floor(advance * face->xscale * 64 + 0.5f);
+    if(x0 == x1 || y0 == y1){
+        //Empty glyph has no bitmap
+        ret.width  = 0;
+        ret.height = 0;
+        ret.bitmap_left = 0;
+        ret.bitmap_top  = 0;
+        return ret;
     }
-    GlyphMetrics glyph;
-    FaceMetrics  m = metrics();
-
-    Uint prev = 0;
-
-    while(cur != end){
-        char32_t ch = Utf8Decode(cur);
-        //TODO: Handle invalid utf8
-        Uint idx = glyph_index(ch);
-        glyph = build_glyph(idx);
+    ret.width  = x1 - x0 + LILIM_SDF_SPREAD * 2;
+    ret.height = y1 - y0 + LILIM_SDF_SPREAD * 2;
+    ret.bitmap_left = x0 - LILIM_SDF_SPREAD;
+    ret.bitmap_top  = -(y0 - LILIM_SDF_SPREAD);
+    return ret;
+}
+void  Face::render_sdf_glyph(Uint code,void *b,int pitch,int pen_x,int pen_y){
+    int width,height;
+    int xoff,yoff;
 
-        int y_offset = m.ascender - glyph.bitmap_top;
+    //128 on edge,go to 0 / 255 at spread
+    uint8_t *sdf = stbtt_GetGlyphSDF(
+        face,
+        face->yscale,
+        code,
+        LILIM_SDF_SPREAD,
+        128,
+        128.0f / LILIM_SDF_SPREAD,
+        &width,
+        &height,
+        &xoff,
+        &yoff
+    );
+    if(sdf == nullptr){
+        //Empty glyph
+        return;
+    }
+    uint8_t *pixels = static_cast<uint8_t*>(b) + pen_y * pitch + pen_x;
+    for(int y = 0;y < height;y++){
+        std::memcpy(pixels,sdf + y * width,width);
+        pixels += pitch;
+    }
+    stbtt_FreeSDF(sdf,face->userdata);
+}
+#endif
 
-        w += glyph.advance_x;
-        h = std::max(h,glyph.height);
-        h = std::max(h,y_offset + glyph.height);
+//Not looked up yet in BMP blocks
+static constexpr Uint CMapUnknown = ~Uint(0);
 
-        //Add kerning
-        if(prev != 0){
-            w += kerning(prev,idx);
+Uint  Face::glyph_index(char32_t codepoint){
+    if(codepoint < 0x10000){
+        Uint *block = cmap_blocks != nullptr ? cmap_blocks[codepoint >> 8] : nullptr;
+        if(block != nullptr && block[codepoint & 0xff] != CMapUnknown){
+            return block[codepoint & 0xff];
         }
-        prev = idx;
     }
-    return {w,h};
+    else if(cmap_count != 0){
+        //Linear probing
+        Uint mask = cmap_capacity - 1;
+        Uint pos  = (codepoint * 2654435761u) & mask;
+        while(cmap_table[pos].codepoint != 0){
+            if(cmap_table[pos].codepoint == codepoint){
+                return cmap_table[pos].index;
+            }
+            pos = (pos + 1) & mask;
+        }
+    }
+    return cmap_insert(codepoint,find_glyph_index(codepoint));
+}
+Uint  Face::cmap_insert(char32_t codepoint,Uint index){
+    if(codepoint < 0x10000){
+        if(cmap_blocks == nullptr){
+            cmap_blocks = static_cast<Uint**>(manager->malloc(sizeof(Uint*) * 256));
+            std::memset(cmap_blocks,0,sizeof(Uint*) * 256);
+        }
+        Uint *&block = cmap_blocks[codepoint >> 8];
+        if(block == nullptr){
+            block = static_cast<Uint*>(manager->malloc(sizeof(Uint) * 256));
+            std::memset(block,0xff,sizeof(Uint) * 256);
+        }
+        block[codepoint & 0xff] = index;
+        return index;
+    }
+    //Codepoint out of BMP is never 0,so 0 is the empty slot
+    if((cmap_count + 1) * 2 > cmap_capacity){
+        //Rehash
+        CMapEntry *old = cmap_table;
+        Uint       ncap = cmap_capacity;
+        cmap_capacity = cmap_capacity == 0 ? 64 : cmap_capacity * 2;
+        cmap_table    = static_cast<CMapEntry*>(manager->malloc(sizeof(CMapEntry) * cmap_capacity));
+        std::memset(cmap_table,0,sizeof(CMapEntry) * cmap_capacity);
+        cmap_count    = 0;
+        for(Uint i = 0;i < ncap;i++){
+            if(old[i].codepoint != 0){
+                cmap_insert(old[i].codepoint,old[i].index);
+            }
+        }
+        manager->free(old);
+    }
+    Uint mask = cmap_capacity - 1;
+    Uint pos  = (codepoint * 2654435761u) & mask;
+    while(cmap_table[pos].codepoint != 0){
+        pos = (pos + 1) & mask;
+    }
+    cmap_table[pos].codepoint = codepoint;
+    cmap_table[pos].index     = index;
+    cmap_count++;
+    return index;
+}
+void  Face::clear_cmap(){
+    if(cmap_blocks != nullptr){
+        for(int i = 0;i < 256;i++){
+            manager->free(cmap_blocks[i]);
+        }
+        manager->free(cmap_blocks);
+    }
+    manager->free(cmap_table);
+    cmap_blocks   = nullptr;
+    cmap_table    = nullptr;
+    cmap_count    = 0;
+    cmap_capacity = 0;
 }
-auto  Face::render_text(const char *text,const char *end) -> Bitmap{
-    Size size = measure_text(text,end);
-    auto blob = manager->alloc_blob(size.width * size.height);
-    auto m    = metrics();
 
-    uint8_t *data = static_cast<uint8_t*>(blob->data());
-    //Begin rendering
-    int pitch = size.width;
-    int pen_x = 0;
-    int pen_y = 0;
+auto  Face::measure_text(const char *text,const char *end) -> Size{
+    return measure_text(text,end,text_run);
+}
+auto  Face::measure_text(const char *text,const char *end,GlyphRun &run) -> Size{
+    LILIM_ASSERT(run.manager == nullptr || run.manager == manager);
+    run.clear();
+    run.manager = manager;
+    run.bpp     = pixel_bytes();
+
+    int w = 0;
+    int h = 0;
 
     const char *cur = text;
     if(end == nullptr){
         end = text + std::strlen(text);
     }
+    FaceMetrics  m = metrics();
 
     Uint prev = 0;
-
-    std::memset(data,0,size.width * size.height);
+    char32_t buffer[LILIM_DECODE_CHUNK];
 
     while(cur != end){
-        char32_t ch = Utf8Decode(cur);
-        Uint idx = glyph_index(ch);
-        GlyphMetrics glyph = build_glyph(idx);
+        size_t n = Utf8Decode(cur,end,buffer,LILIM_DECODE_CHUNK);
+        for(size_t i = 0;i < n;i++){
+            Uint idx = glyph_index(buffer[i]);
+            GlyphMetrics glyph = build_glyph(idx);
 
-        int y_offset = m.ascender - glyph.bitmap_top;
-        int x_offset = glyph.bitmap_left;
+            //Add kerning
+            if(prev != 0){
+                w += kerning(prev,idx);
+            }
+            prev = idx;
 
-        render_glyph(idx,data,pitch,pen_x + x_offset,pen_y + y_offset);
+            int y_offset = m.ascender - glyph.bitmap_top;
 
-        //Move pen
-        pen_x += glyph.advance_x;
+            auto item    = run.push();
+            item->index  = idx;
+            item->x      = w + glyph.bitmap_left;
+            item->y      = y_offset;
+            item->width  = glyph.width;
+            item->height = glyph.height;
 
-        //Add kerning
-        if(prev != 0){
-            pen_x += kerning(prev,idx);
+            w += glyph.advance_x;
+            h = std::max(h,glyph.height);
+            h = std::max(h,y_offset + glyph.height);
         }
-        prev = idx;
     }
+    run.extent = {w,h};
+    return {w,h};
+}
+auto  Face::render_text(const char *text,const char *end) -> Bitmap{
+    Size size = measure_text(text,end,text_run);
+    int  bpp  = text_run.bpp;
+    auto blob = manager->alloc_blob(size_t(size.width) * size.height * bpp);
+
+    render_text(text_run,blob->data(),size.width * bpp,size.width,size.height);
+
     Bitmap ret;
     ret.width  = size.width;
     ret.height = size.height;
     ret.data   = blob;
     return ret;
 }
+auto  Face::render_text(const char *text,const char *end,void *buffer,int pitch,int width,int height) -> Size{
+    Size size = measure_text(text,end,text_run);
+    render_text(text_run,buffer,pitch,width,height);
+    return size;
+}
+auto  Face::render_text(GlyphRun &run,void *buffer,int pitch,int width,int height) -> void{
+    uint8_t *data = static_cast<uint8_t*>(buffer);
+    int      bpp  = run.bpp;
+    for(int y = 0;y < height;y++){
+        std::memset(data + y * pitch,0,size_t(width) * bpp);
+    }
+    for(Uint i = 0;i < run.nglyphs;i++){
+        auto &item = run.glyphs[i];
+        if(item.width <= 0 || item.height <= 0){
+            continue;
+        }
+        if(render_outline(item.index,data,pitch,width,height,item.x,item.y)){
+            //Rasterized in place
+            continue;
+        }
+        if(item.x >= 0 && item.y >= 0 && item.x + item.width <= width && item.y + item.height <= height){
+            //Fully inside
+            render_glyph(item.index,data,pitch,item.x,item.y);
+            continue;
+        }
+        //Clip it by scratch
+        int x0 = std::max(item.x,0);
+        int y0 = std::max(item.y,0);
+        int x1 = std::min(item.x + item.width,width);
+        int y1 = std::min(item.y + item.height,height);
+        if(x0 >= x1 || y0 >= y1){
+            continue;
+        }
+        int      stride  = item.width * bpp;
+        uint8_t *scratch = run.scratch_of(size_t(stride) * item.height);
+        render_glyph(item.index,scratch,stride,0,0);
+        for(int y = y0;y < y1;y++){
+            std::memcpy(
+                data + y * pitch + x0 * bpp,
+                scratch + (y - item.y) * stride + (x0 - item.x) * bpp,
+                size_t(x1 - x0) * bpp
+            );
+        }
+    }
+}
+int   Face::pixel_bytes() const{
+#ifndef LILIM_STBTRUETYPE
+    if((flags & FT_LOAD_TARGET_LCD) == FT_LOAD_TARGET_LCD){
+        return 4;
+    }
+#endif
+    return 1;
+}
+auto  Face::scale_of(Uint size) -> Scale*{
+    //Binary search in sorted scales
+    Scale *end  = scales + nscales;
+    Scale *iter = std::lower_bound(scales,end,size,[](const Scale &s,Uint size){
+        return s.size < size;
+    });
+    if(iter != end && iter->size == size){
+        return iter;
+    }
+    //Not found,create one
+    Uint pos = iter - scales;
+    if(nscales == cscales){
+        cscales = cscales == 0 ? 8 : cscales * 2;
+        scales  = static_cast<Scale*>(manager->realloc(scales,sizeof(Scale) * cscales));
+    }
+    std::memmove(scales + pos + 1,scales + pos,sizeof(Scale) * (nscales - pos));
+    nscales++;
+
+    Scale &s = scales[pos];
+    s.size = size;
+#ifndef LILIM_STBTRUETYPE
+    FT_Size prev = face->size;
+    if(FT_New_Size(face,&s.handle)){
+        std::abort();
+    }
+    FT_Activate_Size(s.handle);
+    FT_Set_Char_Size(
+        face,
+        0,
+        size * 64,
+        xdpi,
+        ydpi
+    );
+    FT_Activate_Size(prev);
+#else
+    FaceSize fsize;
+    fsize.width = size;
+    fsize.height = size;
+    fsize.xdpi = xdpi;
+    fsize.ydpi = ydpi;
+    ScaleOf(face,fsize,&s.xscale,&s.yscale);
+#endif
+    return &s;
+}
+void  Face::clear_scales(){
+#ifndef LILIM_STBTRUETYPE
+    FT_Activate_Size(base);
+    for(Uint i = 0;i < nscales;i++){
+        FT_Done_Size(scales[i].handle);
+    }
+    loaded = ~Uint(0);
+#endif
+    nscales = 0;
+}
 Ref<Face> Face::clone(){
     auto face = manager->new_face(
         blob,
@@ -472,59 +969,166 @@ Ref<Face> Face::clone(){
     return face;
 }
 
+//GlyphRun
+GlyphRun::~GlyphRun(){
+    if(manager != nullptr){
+        manager->free(glyphs);
+        manager->free(scratch);
+    }
+}
+auto GlyphRun::push() -> Item*{
+    if(nglyphs == cglyphs){
+        cglyphs = cglyphs == 0 ? 32 : cglyphs * 2;
+        glyphs  = static_cast<Item*>(manager->realloc(glyphs,sizeof(Item) * cglyphs));
+    }
+    return &glyphs[nglyphs++];
+}
+uint8_t *GlyphRun::scratch_of(size_t bytes){
+    if(bytes > cscratch){
+        cscratch = std::max(bytes,cscratch * 2);
+        scratch  = static_cast<uint8_t*>(manager->realloc(scratch,cscratch));
+    }
+    return scratch;
+}
+
 //Utility functions    
 
-char32_t  Utf8Decode(const char *&str){
-    //Algorithm from utf8 for cpp
-    auto mask = [](char ch) -> uint8_t{
-        return ch & 0xff;
-    };
-    //Get length first
-    int     len = 0;
-    uint8_t lead = mask(*str);
+//Decode one codepoint,invalid sequence is replaced by U+FFFD and skipped by one byte
+//The end could be nullptr on null terminated string
+static inline char32_t Utf8DecodeOne(const uint8_t *&str,const uint8_t *end){
+    uint8_t  lead = *str;
+    int      len;
+    char32_t ret;
+    char32_t min;
     if(lead < 0x80){
-        len = 1;
+        ++str;
+        return lead;
     }
     else if((lead >> 5) == 0x6){
         len = 2;
+        ret = lead & 0x1f;
+        min = 0x80;
     }
     else if((lead >> 4) == 0xe){
         len = 3;
+        ret = lead & 0x0f;
+        min = 0x800;
     }
     else if((lead >> 3) == 0x1e){
         len = 4;
+        ret = lead & 0x07;
+        min = 0x10000;
     }
     else{
-        //Invalid
-        std::abort();
+        ++str;
+        return 0xfffd;
     }
-    //Start
-    char32_t ret = mask(*str);
-    switch (len) {
-        case 1:
-            break;
-        case 2:
-            ++str;
-            ret = ((ret << 6) & 0x7ff) + ((*str) & 0x3f);
-            break;
-        case 3:
-            ++str; 
-            ret = ((ret << 12) & 0xffff) + ((mask(*str) << 6) & 0xfff);
-            ++str;
-            ret += (*str) & 0x3f;
-            break;
-        case 4:
-            ++str;
-            ret = ((ret << 18) & 0x1fffff) + ((mask(*str) << 12) & 0x3ffff);                
-            ++str;
-            ret += (mask(*str) << 6) & 0xfff;
+    if(end != nullptr && end - str < len){
+        //Truncated
+        ++str;
+        return 0xfffd;
+    }
+    for(int i = 1;i < len;i++){
+        //Null terminator is not a continuation byte,so never read over it
+        uint8_t ch = str[i];
+        if((ch & 0xc0) != 0x80){
             ++str;
-            ret += (*str) & 0x3f; 
-            break;
+            return 0xfffd;
+        }
+        ret = (ret << 6) | (ch & 0x3f);
     }
-    ++str;
+    if(ret < min || ret > 0x10ffff || (ret >= 0xd800 && ret <= 0xdfff)){
+        //Overlong or surrogate or out of range
+        ++str;
+        return 0xfffd;
+    }
+    str += len;
+    return ret;
+}
+#ifdef LILIM_SSE2
+static inline int CountTrailingZeros(unsigned int mask){
+#ifdef _MSC_VER
+    unsigned long idx;
+    _BitScanForward(&idx,mask);
+    return idx;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+#endif
+
+char32_t  Utf8Decode(const char *&str){
+    auto cur = reinterpret_cast<const uint8_t*>(str);
+    char32_t ret = Utf8DecodeOne(cur,nullptr);
+    str = reinterpret_cast<const char*>(cur);
     return ret;
 }
+size_t    Utf8Decode(const char *&str,const char *end,char32_t *out,size_t n){
+    auto cur  = reinterpret_cast<const uint8_t*>(str);
+    auto last = reinterpret_cast<const uint8_t*>(end);
+    size_t count = 0;
+
+    while(cur < last && count < n){
+#ifdef LILIM_AVX2
+        //32 ASCII chars at once
+        while(last - cur >= 32 && n - count >= 32){
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cur));
+            if(_mm256_movemask_epi8(v) != 0){
+                break;
+            }
+            for(int i = 0;i < 4;i++){
+                __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(cur + i * 8));
+                _mm256_storeu_si256(
+                    reinterpret_cast<__m256i*>(out + count + i * 8),
+                    _mm256_cvtepu8_epi32(bytes)
+                );
+            }
+            cur   += 32;
+            count += 32;
+        }
+#endif
+#ifdef LILIM_SSE2
+        //16 ASCII chars at once
+        while(last - cur >= 16 && n - count >= 16){
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cur));
+            int mask  = _mm_movemask_epi8(v);
+            if(mask != 0){
+                //Copy the ASCII prefix,then leave the rest to scalar
+                int ascii = CountTrailingZeros(mask);
+                for(int i = 0;i < ascii;i++){
+                    out[count++] = cur[i];
+                }
+                cur += ascii;
+                break;
+            }
+            __m128i zero = _mm_setzero_si128();
+            __m128i lo   = _mm_unpacklo_epi8(v,zero);
+            __m128i hi   = _mm_unpackhi_epi8(v,zero);
+            auto    dst  = reinterpret_cast<__m128i*>(out + count);
+            _mm_storeu_si128(dst + 0,_mm_unpacklo_epi16(lo,zero));
+            _mm_storeu_si128(dst + 1,_mm_unpackhi_epi16(lo,zero));
+            _mm_storeu_si128(dst + 2,_mm_unpacklo_epi16(hi,zero));
+            _mm_storeu_si128(dst + 3,_mm_unpackhi_epi16(hi,zero));
+            cur   += 16;
+            count += 16;
+        }
+        if(cur < last && count < n){
+            //Tail or non ASCII
+            out[count++] = Utf8DecodeOne(cur,last);
+        }
+#else
+        //ASCII fast path
+        while(cur < last && count < n && *cur < 0x80){
+            out[count++] = *cur++;
+        }
+        if(cur < last && count < n){
+            out[count++] = Utf8DecodeOne(cur,last);
+        }
+#endif
+    }
+    str = reinterpret_cast<const char*>(cur);
+    return count;
+}
 
 Ref<Blob> MapFile(const char *file){
 #ifdef _WIN32
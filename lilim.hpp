@@ -24,6 +24,8 @@
     #include FT_FREETYPE_H
     #include FT_OUTLINE_H
     #include FT_GLYPH_H
+    #include FT_SIZES_H
+    #include FT_MODULE_H
 #else
     #define FT_Face _lilim_fontinfo*
     #define FT_Library void        *
@@ -39,9 +41,21 @@
     #define LILIM_UNUSED(x) (void)(x)
 #endif
 
+//Number of codepoints decoded at once on stack
+#ifndef LILIM_DECODE_CHUNK
+    #define LILIM_DECODE_CHUNK 256
+#endif
+
+//Padding of signed distance field glyphs in pixels(the distance range of 0 - 255)
+#ifndef LILIM_SDF_SPREAD
+    #define LILIM_SDF_SPREAD 8
+#endif
+
 #include <cstdlib>
 #include <cstdint>
 #include <cstdio>
+#include <atomic>
+#include <mutex>
 
 
 LILIM_NS_BEGIN
@@ -51,7 +65,7 @@ using Int  = int;
 
 class Manager;
 class Face;
-// Bultin refcounter
+// Bultin refcounter(atomic,objects could be shared between threads)
 template<class T>
 class Refable {
     public:
@@ -60,15 +74,15 @@ class Refable {
         ~Refable() = default;
 
         void ref() noexcept{
-            ++refcount;
+            refcount.fetch_add(1,std::memory_order_relaxed);
         }
         void unref() noexcept{
-            if(--refcount == 0){
+            if(refcount.fetch_sub(1,std::memory_order_acq_rel) == 1){
                 delete static_cast<T*>(this);
             }
         }
     private:
-        int refcount = 0;
+        std::atomic<int> refcount{0};
 };
 // Managed refcounter
 template<class T>
@@ -226,6 +240,8 @@ class Manager {
     private:
         FT_Library library;
         MemHandler memory;
+        std::mutex mutex;//< Faces are created / destroyed in lock(the library is shared by threads)
+    friend class Face;
 };
 
 /**
@@ -239,6 +255,7 @@ class GlyphMetrics {
         int bitmap_left;
         int bitmap_top;
         int advance_x;
+        int advance_x64;//< Unhinted advance in 26.6 fixed point
 };
 /**
  * @brief Size of a face (with dpi)
@@ -274,6 +291,17 @@ class FaceMetrics {
         float underline_thickness = 0;
 };
 
+/**
+ * @brief A kerning pair of glyphs (advance in font units)
+ * 
+ */
+class KerningPair {
+    public:
+        Uint left;
+        Uint right;
+        Int  advance;
+};
+
 class Bitmap : public Size {
     public:
         Ref<Blob> data;
@@ -282,6 +310,54 @@ class Bitmap : public Size {
         }
 };
 
+/**
+ * @brief Glyphs of a string measured by Face::measure_text,reused by Face::render_text
+ * 
+ * @note The storage only grows(by the manager of the first face),so a run reused for many strings allocates nothing after warming up
+ */
+class GlyphRun {
+    public:
+        GlyphRun() = default;
+        GlyphRun(const GlyphRun &) = delete;
+        ~GlyphRun();
+
+        /**
+         * @brief Get the size of the measured text
+         * 
+         * @return Size 
+         */
+        Size size() const noexcept{
+            return extent;
+        }
+        Uint count() const noexcept{
+            return nglyphs;
+        }
+        void clear() noexcept{
+            nglyphs = 0;
+            extent  = {0,0};
+        }
+    private:
+        struct Item {
+            Uint index;
+            int  x;//< Left of the bitmap in text
+            int  y;//< Top of the bitmap in text
+            int  width;
+            int  height;
+        };
+        Item    *push();
+        uint8_t *scratch_of(size_t bytes);
+
+        Manager *manager  = nullptr;
+        Item    *glyphs   = nullptr;
+        Uint     nglyphs  = 0;
+        Uint     cglyphs  = 0;
+        uint8_t *scratch  = nullptr;//< For glyphs clipped by the buffer
+        size_t   cscratch = 0;
+        Size     extent;
+        int      bpp = 1;//< Bytes per pixel of the face
+    friend class Face;
+};
+
 enum Style : Uint {
     Normal    = 0,
     Bold      = 1 << 0,
@@ -312,10 +388,39 @@ class Face: public Refable<Face> {
         Uint      load_flags() const{
             return flags;
         }
+        Uint      style_flags() const{
+            return styles;
+        }
+        Uint      face_index() const{
+            return idx;
+        }
+        /**
+         * @brief Get the font file of the face
+         *
+         * @return Blob*
+         */
+        Blob     *data() const{
+            return blob.get();
+        }
+        void      get_dpi(Uint *xdpi,Uint *ydpi) const{
+            *xdpi = this->xdpi;
+            *ydpi = this->ydpi;
+        }
 
         void  set_dpi    (Uint xdpi,Uint ydpi);
         void  set_size   (FaceSize size);
+        /**
+         * @brief Set the current size(the scale of each size is cached)
+         * 
+         * @param size 
+         */
         void  set_size   (Uint     size);
+        /**
+         * @brief Set the horizontal subpixel offset of the glyph origin(for build_glyph / render_glyph)
+         * 
+         * @param x The offset in pixels(in [0,1),0 by default)
+         */
+        void  set_subpixel(float   x);
         void  set_style  (Uint     style);
         void  set_flags  (Uint     flags);
         /**
@@ -326,15 +431,51 @@ class Face: public Refable<Face> {
          * @return The kerning distance
          */
         Int   kerning    (Uint left,Uint right);
+        /**
+         * @brief Get kerning of two glyphs at the size
+         * 
+         * @note The current size of the face is not changed
+         * 
+         * @param size The size
+         * @param left The left glyph
+         * @param right The right glyph
+         * @return The kerning distance
+         */
+        Int   kerning    (Uint size,Uint left,Uint right);
+        /**
+         * @brief Check the face has kerning info
+         * 
+         * @note On stb_truetype backend,kerning is enabled by LILIM_STB_KERNING
+         */
+        bool  has_kerning();
+        /**
+         * @brief Get the whole pair kerning table(if the backend support it)
+         * 
+         * @param pairs The output pairs(nullptr on querying the length)
+         * @param n The max number of pairs to write
+         * @return The number of pairs (0 on not supported)
+         */
+        int   kerning_pairs(KerningPair *pairs,int n);
         /**
          * @brief Convert a UTF32 codepoint to a glyph index
          * 
+         * @note The result is cached,so cmap is parsed only once for each codepoint
+         * 
          * @param codepoint 
          * @return Index (0 on not founded)
          */
         Uint  glyph_index(char32_t codepoint);
 
         auto  metrics()              -> FaceMetrics;
+        /**
+         * @brief Get metrics at the size
+         * 
+         * @note The current size of the face is not changed
+         * 
+         * @param size 
+         * @return FaceMetrics 
+         */
+        auto  metrics(Uint size)     -> FaceMetrics;
         auto  build_glyph(Uint code) -> GlyphMetrics;
         /**
          * @brief Render a glyph at the given position
@@ -352,6 +493,35 @@ class Face: public Refable<Face> {
             int pen_x,
             int pen_y
         ) -> void;
+        /**
+         * @brief Get metrics of a glyph rendered as signed distance field
+         * 
+         * @note The bitmap is padded by LILIM_SDF_SPREAD on each side
+         * 
+         * @param code The Glyph Index
+         * @return GlyphMetrics 
+         */
+        auto  build_sdf_glyph(Uint code) -> GlyphMetrics;
+        /**
+         * @brief Render the signed distance field of a glyph at the given position
+         * 
+         * @note Each pixel is 8 bits,128 is on the edge and bigger is inside,
+         *       one unit is LILIM_SDF_SPREAD / 128 pixels
+         *       (FreeType older than 2.11 has no sdf renderer,the coverage is rendered instead)
+         * 
+         * @param code The Glyph Index
+         * @param buffer The buffer to render to(8 bits per pixel)
+         * @param pitch The buffer pitch
+         * @param pen_x The pen x position
+         * @param pen_y The pen y position
+         */
+        auto  render_sdf_glyph(
+            Uint code,
+            void *buffer,
+            int pitch,
+            int pen_x,
+            int pen_y
+        ) -> void;
         /**
          * @brief Get Size of a string
          * 
@@ -360,6 +530,15 @@ class Face: public Refable<Face> {
          * @return Size 
          */
         auto measure_text(const char *text,const char *end = nullptr) -> Size;
+        /**
+         * @brief Measure a string and keep the glyph metrics in the run
+         * 
+         * @param text The UTF8 text begin
+         * @param end The UTF8 text end(nullptr on null terminated)
+         * @param run The output run
+         * @return Size 
+         */
+        auto measure_text(const char *text,const char *end,GlyphRun &run) -> Size;
         /**
          * @brief Render a string
          * 
@@ -368,14 +547,115 @@ class Face: public Refable<Face> {
          * @return Bitmap 
          */
         auto render_text(const char *text,const char *end = nullptr) -> Bitmap;
+        /**
+         * @brief Render a string into the buffer(glyphs out of width / height are clipped)
+         * 
+         * @note The buffer is 1 byte per pixel(4 bytes as render_glyph on LCD faces),no memory is allocated after warming up
+         * 
+         * @param text The UTF8 text begin
+         * @param end The UTF8 text end(nullptr on null terminated)
+         * @param buffer The buffer to render to
+         * @param pitch The buffer pitch in bytes
+         * @param width The buffer width in pixels
+         * @param height The buffer height in pixels
+         * @return The size of the whole text
+         */
+        auto render_text(const char *text,const char *end,void *buffer,int pitch,int width,int height) -> Size;
+        /**
+         * @brief Render a measured run into the buffer(glyphs are not built again)
+         * 
+         * @note The face must be at the size of measuring,the buffer format is same as above
+         * 
+         * @param run The run from measure_text
+         * @param buffer The buffer to render to
+         * @param pitch The buffer pitch in bytes
+         * @param width The buffer width in pixels
+         * @param height The buffer height in pixels
+         */
+        auto render_text(GlyphRun &run,void *buffer,int pitch,int width,int height) -> void;
     private:
         Face();
+        /**
+         * @brief Scale state of the face at one size
+         * 
+         */
+        struct Scale {
+            Uint    size;
+#ifndef LILIM_STBTRUETYPE
+            FT_Size handle;
+#else
+            float   xscale;
+            float   yscale;
+#endif
+        };
+        /**
+         * @brief Get or create the scale of the size
+         * 
+         * @param size 
+         * @return Scale* 
+         */
+        Scale    *scale_of(Uint size);
+        void      clear_scales();
+        /**
+         * @brief Cached glyph index of a codepoint out of BMP
+         * 
+         */
+        struct CMapEntry {
+            char32_t codepoint;
+            Uint     index;
+        };
+        /**
+         * @brief Lookup the glyph index from cmap of the font
+         * 
+         * @param codepoint 
+         * @return Uint 
+         */
+        Uint      find_glyph_index(char32_t codepoint);
+        Uint      cmap_insert(char32_t codepoint,Uint index);
+        void      clear_cmap();
+        /**
+         * @brief Get bytes per pixel of render_glyph
+         * 
+         * @return int 
+         */
+        int       pixel_bytes() const;
+        /**
+         * @brief Rasterize the outline of a glyph into the buffer directly(clipped by width / height)
+         * 
+         * @param x The left of the glyph bitmap in buffer
+         * @param y The top of the glyph bitmap in buffer
+         * @return false Not supported(stb backend,LCD face or bitmap glyph),nothing is written
+         */
+        bool      render_outline(Uint code,void *buffer,int pitch,int width,int height,int x,int y);
+#ifndef LILIM_STBTRUETYPE
+        /**
+         * @brief Load the glyph into the slot,skipped if it is already there with the same state
+         * 
+         * @note So build_glyph + render_glyph of a glyph only decode / hint it once
+         * @param code The glyph index
+         * @param outline Require the outline(reload if the slot was rendered to bitmap)
+         */
+        void      load_glyph(Uint code,bool outline = false);
+#endif
 
         Manager  *manager;
         Ref<Blob> blob;
         FT_Face   face;
+        Scale    *scales; // Sorted by size
+        Uint      nscales;
+        Uint      cscales;
+        Uint    **cmap_blocks; // 256 blocks of 256 codepoints in BMP(nullptr on not seen)
+        CMapEntry*cmap_table; // Hash table for codepoints out of BMP
+        Uint      cmap_count;
+        Uint      cmap_capacity;
+        GlyphRun  text_run; // Reused by measure_text / render_text without run
+#ifndef LILIM_STBTRUETYPE
+        FT_Size   base; // The size created with face,used by set_size(FaceSize)
+        Uint      loaded; // Glyph index in the slot(~0 on none),reset on size / flags / transform changed
+#endif
         Uint      styles; // Style
         Uint      flags; // FT_LOAD_XXX
+        int       shift; // Subpixel offset in 26.6
         Uint      xdpi; // DPI in set_size(Uint)
         Uint      ydpi; // DPI in set_size(Uint)
         Uint      idx; // Face Index 
@@ -389,11 +669,22 @@ inline int64_t  FixedCeil(int64_t x);
 /**
  * @brief Decode UTF8 and move the pointer to the next char
  * 
- * @note It would change the input pointer
+ * @note It would change the input pointer,invalid sequence is decoded as U+FFFD
  * @param str The pointer of the UTF8 string
  * @return UTF32 codepoint
  */
 extern char32_t  Utf8Decode(const char *&str);
+/**
+ * @brief Decode UTF8 range into the buffer(SIMD for ASCII if available)
+ * 
+ * @note It would change the input pointer,invalid sequence is decoded as U+FFFD
+ * @param str The pointer of the UTF8 string begin
+ * @param end The UTF8 string end
+ * @param out The output buffer
+ * @param n The max number of codepoints to decode
+ * @return The number of decoded codepoints
+ */
+extern size_t    Utf8Decode(const char *&str,const char *end,char32_t *out,size_t n);
 /**
  * @brief Load a file from disk
  * 
@@ -424,8 +715,14 @@ inline void  Manager::free(void *ptr){
 //Face
 inline void Face::set_flags(Uint flags){
     this->flags = flags;
+#ifndef LILIM_STBTRUETYPE
+    loaded = ~Uint(0);
+#endif
 }
 inline void Face::set_dpi(Uint xdpi,Uint ydpi){
+    if(this->xdpi != xdpi || this->ydpi != ydpi){
+        clear_scales();
+    }
     this->xdpi = xdpi;
     this->ydpi = ydpi;
 }
@@ -0,0 +1,125 @@
+//Rasterizing in background:placeholders are drawn until the glyphs are polled,then the same as synchronous
+#include "lilim.cpp"
+#include "fontstash.cpp"
+#include "test_util.hpp"
+
+using namespace Fons;
+
+//Keep the vertices of the last flush and hash the glyph bitmaps
+class VertexRenderer : public TextRenderer {
+    public:
+        using TextRenderer::TextRenderer;
+        using TextRenderer::reset;
+
+        std::vector<Vertex> vertices;
+        uint64_t            hash = 0;
+    private:
+        void render_update(int,int,int,int,int) override{}
+        void render_resize(int,int) override{}
+        void render_flush() override{}
+        void render_draw(const Vertex *verts,int nverts) override{
+            vertices.assign(verts,verts + nverts);
+            hash = test_hash(nullptr,0);
+            for(const Vertex &v : vertices){
+                hash = test_hash(&v.screen_x,sizeof(float) * 4,hash);
+                int w;
+                auto pixels = static_cast<const Pixel*>(get_data(v.page,&w,nullptr));
+                for(int y = 0;y < v.glyph_h;y++){
+                    hash = test_hash(pixels + (v.glyph_y + y) * w + v.glyph_x,v.glyph_w * sizeof(Pixel),hash);
+                }
+            }
+        }
+};
+
+static const char *text = "Async glyphs AVWa";
+
+static void draw(VertexRenderer &r,int font){
+    r.set_font(font);
+    r.set_color(0xFFFFFFFF);
+    r.set_size(32);
+    r.draw_text(4,40,text);
+    r.flush();
+}
+//A placeholder is a stretched texel
+static bool all_placeholders(const VertexRenderer &r){
+    for(const Vertex &v : r.vertices){
+        if(v.glyph_w != 1 || v.glyph_h != 1){
+            return false;
+        }
+    }
+    return !r.vertices.empty();
+}
+
+static void test_placeholder_replaced(Fontstash &stash,int font){
+    VertexRenderer expected(stash,256,256);
+    draw(expected,font);
+
+    VertexRenderer r(stash,256,256);
+    r.set_async(true);
+    r.set_placeholder(true);
+    draw(r,font);
+    uint32_t ticket = r.last_ticket();
+    TEST_CHECK(ticket != 0);
+    TEST_CHECK(all_placeholders(r));
+    //Space has a glyph too,so one for each char
+    TEST_CHECK(r.vertices.size() == expected.vertices.size());
+
+    TEST_CHECK(r.wait_glyphs() >= ticket);
+    draw(r,font);
+    TEST_CHECK(r.last_ticket() == 0);
+    TEST_CHECK(!all_placeholders(r));
+    TEST_CHECK(r.hash == expected.hash);
+}
+static void test_skipped_without_placeholder(Fontstash &stash,int font){
+    VertexRenderer r(stash,256,256);
+    r.set_async(true);
+    draw(r,font);
+    TEST_CHECK(r.last_ticket() != 0);
+    TEST_CHECK(r.vertices.empty());
+    r.wait_glyphs();
+    draw(r,font);
+    TEST_CHECK(r.last_ticket() == 0);
+    TEST_CHECK(!r.vertices.empty());
+}
+//Bitmaps queued before a reset must not land in the new atlas
+static void test_reset_while_queued(Fontstash &stash,int font){
+    VertexRenderer expected(stash,256,256);
+    draw(expected,font);
+
+    VertexRenderer r(stash,256,256);
+    r.set_async(true);
+    r.set_placeholder(true);
+    draw(r,font);
+    TEST_CHECK(r.last_ticket() != 0);
+    r.reset(256,256);
+    //Queued again in the new atlas
+    draw(r,font);
+    TEST_CHECK(r.last_ticket() != 0);
+    r.wait_glyphs();
+    draw(r,font);
+    TEST_CHECK(r.last_ticket() == 0);
+    TEST_CHECK(r.hash == expected.hash);
+
+    //Nothing queued now,the old results don't overwrite the glyphs
+    r.reset(256,256);
+    r.set_async(false);
+    draw(r,font);
+    TEST_CHECK(r.hash == expected.hash);
+}
+
+int main(){
+    Lilim::Manager manager;
+    auto face = manager.new_face(TEST_FONT,0);
+    TEST_CHECK(!face.empty());
+    if(face.empty()){
+        return test_result("test_async");
+    }
+    face->set_dpi(96,96);
+    Fontstash stash(manager);
+    int font = stash.add_font(face);
+
+    test_placeholder_replaced(stash,font);
+    test_skipped_without_placeholder(stash,font);
+    test_reset_while_queued(stash,font);
+    return test_result("test_async");
+}
@@ -0,0 +1,250 @@
+//Atlas cache files:loaded back the same,broken ones are refused without touching the atlas
+#include "lilim.cpp"
+#include "fontstash.cpp"
+#include "test_util.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+using namespace Fons;
+
+static const char *cache_path = "test_atlas_cache.bin";
+
+//The largest allocation,a refused header must not allocate its pages
+static size_t largest_alloc = 0;
+void *operator new(size_t n){
+    largest_alloc = std::max(largest_alloc,n);
+    if(void *p = std::malloc(n ? n : 1)){
+        return p;
+    }
+    throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept{
+    std::free(p);
+}
+void operator delete(void *p,size_t) noexcept{
+    std::free(p);
+}
+
+//Hash the vertices and the glyph bitmaps they point to
+class HashRenderer : public TextRenderer {
+    public:
+        using TextRenderer::TextRenderer;
+        using TextRenderer::atlas_pages;
+
+        uint64_t hash = test_hash(nullptr,0);
+    private:
+        void render_update(int,int,int,int,int) override{}
+        void render_resize(int,int) override{}
+        void render_flush() override{}
+        void render_draw(const Vertex *verts,int nverts) override{
+            for(int i = 0;i < nverts;i++){
+                const Vertex &v = verts[i];
+                hash = test_hash(&v.screen_x,sizeof(float) * 4,hash);
+                hash = test_hash(&v.glyph_w,sizeof(int) * 4,hash);
+                int w;
+                auto pixels = static_cast<const Pixel*>(get_data(v.page,&w,nullptr));
+                for(int y = 0;y < v.glyph_h;y++){
+                    hash = test_hash(pixels + (v.glyph_y + y) * w + v.glyph_x,v.glyph_w * sizeof(Pixel),hash);
+                }
+            }
+        }
+};
+
+static uint64_t draw(HashRenderer &r,int font,const char *text){
+    r.set_font(font);
+    r.set_color(0xFFFFFFFF);
+    r.set_size(24);
+    r.hash = test_hash(nullptr,0);
+    r.draw_text(0,30,text);
+    r.flush();
+    return r.hash;
+}
+
+static std::vector<uint8_t> read_file(const char *path){
+    std::vector<uint8_t> data;
+    FILE *fp = std::fopen(path,"rb");
+    if(fp == nullptr){
+        return data;
+    }
+    uint8_t buf[4096];
+    size_t n;
+    while((n = std::fread(buf,1,sizeof(buf),fp)) > 0){
+        data.insert(data.end(),buf,buf + n);
+    }
+    std::fclose(fp);
+    return data;
+}
+static void write_file(const char *path,const std::vector<uint8_t> &data){
+    FILE *fp = std::fopen(path,"wb");
+    if(!data.empty()){
+        std::fwrite(data.data(),1,data.size(),fp);
+    }
+    std::fclose(fp);
+}
+template<class T>
+static void poke(std::vector<uint8_t> &data,size_t offset,T value){
+    std::memcpy(data.data() + offset,&value,sizeof(T));
+}
+template<class T>
+static T peek(const std::vector<uint8_t> &data,size_t offset){
+    T value;
+    std::memcpy(&value,data.data() + offset,sizeof(T));
+    return value;
+}
+
+static const char *saved_text = "Cached glyphs AVWa";
+static const char *other_text = "0123456789 xyz";
+
+//A broken file is refused,the renderer draws as before
+static void expect_refused(HashRenderer &r,int font,uint64_t before,const std::vector<uint8_t> &data,const char *what){
+    write_file(cache_path,data);
+    int pages = r.atlas_pages();
+    Size size = r.atlas_size();
+    bool loaded = r.load_cache(cache_path);
+    TEST_CHECK(!loaded);
+    TEST_CHECK(r.atlas_pages() == pages);
+    TEST_CHECK(r.atlas_size().width == size.width && r.atlas_size().height == size.height);
+    bool same = draw(r,font,other_text) == before;
+    TEST_CHECK(same);
+    if(loaded || !same){
+        std::printf("  broken file: %s\n",what);
+    }
+}
+
+int main(){
+    Lilim::Manager manager;
+    auto face = manager.new_face(TEST_FONT,0);
+    TEST_CHECK(!face.empty());
+    if(face.empty()){
+        return test_result("test_atlas_cache");
+    }
+    face->set_dpi(96,96);
+    Fontstash stash(manager);
+    int font = stash.add_font(face);
+
+    HashRenderer saver(stash,256,256);
+    uint64_t expected = draw(saver,font,saved_text);
+    TEST_CHECK(saver.save_cache(cache_path));
+    const std::vector<uint8_t> good = read_file(cache_path);
+    TEST_CHECK(!good.empty());
+
+    //Round trip,the glyphs are found in the same place
+    {
+        HashRenderer loader(stash,128,128);
+        draw(loader,font,other_text);
+        TEST_CHECK(loader.load_cache(cache_path));
+        TEST_CHECK(draw(loader,font,saved_text) == expected);
+    }
+
+    HashRenderer r(stash,128,128);
+    uint64_t before = draw(r,font,other_text);
+
+    //Layout:header(6 x int32),then for the page:nnodes,nodes(3 x short),nfree,rects(4 x short),pixels
+    const int    w = 256;
+    const int    h = 256;
+    const size_t nodes = 6 * 4 + 4;
+    const int    nnodes = peek<int32_t>(good,nodes - 4);
+    const size_t nfree = nodes + nnodes * 6;
+    TEST_CHECK(nnodes > 0);
+    TEST_CHECK(saver.atlas_pages() == 1);
+
+    //Truncated anywhere
+    for(size_t len : {size_t(0),size_t(10),size_t(24),nfree,good.size() / 2,good.size() - 1}){
+        std::vector<uint8_t> data(good.begin(),good.begin() + len);
+        expect_refused(r,font,before,data,"truncated");
+    }
+    //Header of a huge atlas,or pixels missing,refused before allocating the pages
+    for(int32_t size : {int32_t(FONS_MAX_ATLAS_SIZE + 1),int32_t(SHRT_MAX),int32_t(FONS_MAX_ATLAS_SIZE)}){
+        std::vector<uint8_t> data(good.begin(),good.begin() + 36);
+        poke<int32_t>(data,12,size);
+        poke<int32_t>(data,16,size);
+        poke<int32_t>(data,20,FONS_MAX_ATLAS_PAGES);
+        largest_alloc = 0;
+        expect_refused(r,font,before,data,"atlas too big");
+        TEST_CHECK(largest_alloc < size_t(w) * h * sizeof(Pixel));
+    }
+    //Skyline nodes
+    {
+        auto data = good;
+        poke<short>(data,nodes,5);
+        expect_refused(r,font,before,data,"node not at the left");
+    }
+    {
+        auto data = good;
+        poke<short>(data,nodes + 2,-1);
+        expect_refused(r,font,before,data,"negative node");
+    }
+    {
+        auto data = good;
+        poke<short>(data,nodes + 2,short(h + 1));
+        expect_refused(r,font,before,data,"node below the page");
+    }
+    {
+        auto data = good;
+        poke<short>(data,nodes + (nnodes - 1) * 6 + 4,short(w));
+        expect_refused(r,font,before,data,"node past the right");
+    }
+    if(nnodes >= 2){
+        auto data = good;
+        std::swap_ranges(data.begin() + nodes,data.begin() + nodes + 6,data.begin() + nodes + 6);
+        expect_refused(r,font,before,data,"nodes not sorted");
+    }
+    //Free rects
+    for(short x : {short(-1),short(w - 4)}){
+        auto data = good;
+        int32_t count = peek<int32_t>(data,nfree);
+        poke<int32_t>(data,nfree,count + 1);
+        short rect[4] = {x,0,8,8};
+        auto p = reinterpret_cast<const uint8_t*>(rect);
+        data.insert(data.begin() + nfree + 4,p,p + sizeof(rect));
+        expect_refused(r,font,before,data,"free rect out of the page");
+    }
+    //Glyph records,the last one of the file
+    const size_t glyph = good.size() - sizeof(CacheGlyph);
+    auto corrupt_glyph = [&](const char *what,void (*fn)(CacheGlyph &)){
+        auto data = good;
+        CacheGlyph c = peek<CacheGlyph>(data,glyph);
+        TEST_CHECK(c.size == 24);
+        fn(c);
+        poke(data,glyph,c);
+        expect_refused(r,font,before,data,what);
+    };
+    corrupt_glyph("glyph past the right",[](CacheGlyph &c){
+        c.x = 256 - c.metrics[0] + 1;
+        c.y = 0;
+    });
+    corrupt_glyph("glyph negative",[](CacheGlyph &c){
+        c.x = 0;
+        c.y = -2;
+    });
+    corrupt_glyph("glyph on a missing page",[](CacheGlyph &c){
+        c.x = 0;
+        c.y = 0;
+        c.page = 1;
+    });
+    corrupt_glyph("glyph too big",[](CacheGlyph &c){
+        c.x = 0;
+        c.y = 0;
+        c.metrics[1] = 1 << 20;
+    });
+    corrupt_glyph("size zero",[](CacheGlyph &c){
+        c.size = 0;
+    });
+    corrupt_glyph("size too big",[](CacheGlyph &c){
+        c.size = FONS_MAX_FONT_SIZE + 1;
+    });
+    corrupt_glyph("blur too big",[](CacheGlyph &c){
+        c.blur = FONS_MAX_BLUR + 1;
+    });
+    corrupt_glyph("subpixel out of range",[](CacheGlyph &c){
+        c.subpixel = FONS_SUBPIXEL_LEVELS;
+    });
+
+    //Still loads after all
+    write_file(cache_path,good);
+    TEST_CHECK(r.load_cache(cache_path));
+    TEST_CHECK(draw(r,font,saved_text) == expected);
+    std::remove(cache_path);
+    return test_result("test_atlas_cache");
+}
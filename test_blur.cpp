@@ -0,0 +1,103 @@
+//BlurRect(SIMD if available) against the scalar filter of nanovg fontstash
+#include "lilim.cpp"
+#include "fontstash.cpp"
+#include "test_util.hpp"
+
+using namespace Fons;
+
+//Filter along x in each row,channels are bytes of a pixel
+static void reference_rows(uint8_t *dst,int w,int h,int stride,int channels,int alpha){
+    for(int y = 0;y < h;y++){
+        for(int c = 0;c < channels;c++){
+            uint8_t *row = dst + y * stride + c;
+            int z = 0;
+            for(int x = 1;x < w;x++){
+                z += (alpha * ((int(row[x * channels]) << blur_zprec) - z)) >> blur_aprec;
+                row[x * channels] = uint8_t(z >> blur_zprec);
+            }
+            row[(w - 1) * channels] = 0;
+            z = 0;
+            for(int x = w - 2;x >= 0;x--){
+                z += (alpha * ((int(row[x * channels]) << blur_zprec) - z)) >> blur_aprec;
+                row[x * channels] = uint8_t(z >> blur_zprec);
+            }
+            row[0] = 0;
+        }
+    }
+}
+//Filter along y in each column
+static void reference_cols(uint8_t *dst,int w,int h,int stride,int channels,int alpha){
+    for(int x = 0;x < w * channels;x++){
+        uint8_t *col = dst + x;
+        int z = 0;
+        for(int y = 1;y < h;y++){
+            z += (alpha * ((int(col[y * stride]) << blur_zprec) - z)) >> blur_aprec;
+            col[y * stride] = uint8_t(z >> blur_zprec);
+        }
+        col[(h - 1) * stride] = 0;
+        z = 0;
+        for(int y = h - 2;y >= 0;y--){
+            z += (alpha * ((int(col[y * stride]) << blur_zprec) - z)) >> blur_aprec;
+            col[y * stride] = uint8_t(z >> blur_zprec);
+        }
+        col[0] = 0;
+    }
+}
+static void reference_blur(Pixel *dst,int w,int h,int pitch,int blur){
+    if(blur < 1 || w < 2 || h < 2){
+        return;
+    }
+    int alpha = BlurAlpha(blur);
+    auto bytes = reinterpret_cast<uint8_t*>(dst);
+    for(int pass = 0;pass < 2;pass++){
+        reference_cols(bytes,w,h,pitch * bytes_per_pixels,bytes_per_pixels,alpha);
+        reference_rows(bytes,w,h,pitch * bytes_per_pixels,bytes_per_pixels,alpha);
+    }
+}
+
+static uint32_t seed = 7;
+static uint32_t next_random(){
+    seed = seed * 1664525u + 1013904223u;
+    return seed;
+}
+
+static void test_sizes(){
+    //Odd sizes around the 8 / 16 bytes lanes,alpha >= 0x8000 for the small radius
+    const int sizes[] = {1,2,3,5,7,8,9,15,16,17,23,31,32,33,41};
+    for(int blur : {1,2,3,4,7,FONS_MAX_BLUR}){
+        for(int w : sizes){
+            for(int h : sizes){
+                //Padding after each row must be untouched
+                int pitch = w + 3;
+                std::vector<Pixel> pixels(size_t(pitch) * h);
+                for(auto &p : pixels){
+                    p = Pixel(next_random());
+                }
+                std::vector<Pixel> expected = pixels;
+                BlurRect(pixels.data(),w,h,pitch,blur);
+                reference_blur(expected.data(),w,h,pitch,blur);
+                TEST_CHECK(pixels == expected);
+            }
+        }
+    }
+}
+static void test_glyph(){
+    //A solid box is spread into the padding,the borders stay zero
+    const int size = 21;
+    std::vector<Pixel> pixels(size * size,Pixel(0));
+    for(int y = 7;y < 14;y++){
+        for(int x = 7;x < 14;x++){
+            pixels[y * size + x] = Pixel(~0u);
+        }
+    }
+    BlurRect(pixels.data(),size,size,size,3);
+    TEST_CHECK(pixels[10 * size + 4] != 0);
+    TEST_CHECK(pixels[10 * size + 10] != Pixel(~0u));
+    TEST_CHECK(pixels[0] == 0);
+}
+
+int main(){
+    test_sizes();
+    test_glyph();
+    return test_result("test_blur");
+}
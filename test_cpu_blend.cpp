@@ -0,0 +1,69 @@
+//CPUTextRenderer::blend_row(SIMD if available) against the scalar blending
+#include "lilim.cpp"
+#include "fontstash.cpp"
+#define FONS_CPU_RENDERER
+#include "fons_backend.hpp"
+#include "test_util.hpp"
+
+using namespace Fons;
+
+static uint32_t seed = 1;
+static uint32_t next_random(){
+    seed = seed * 1664525u + 1013904223u;
+    return seed;
+}
+
+static void test_widths(){
+    //Not multiple of the 4 / 8 pixels lanes,at every offset in the row
+    for(int iter = 0;iter < 20;iter++){
+        for(int n = 0;n <= 41;n++){
+            for(int offset = 0;offset < 8;offset++){
+                std::vector<Pixel>   src(offset + n);
+                std::vector<uint8_t> dst((offset + n + 8) * 4);
+                for(auto &p : src){
+                    p = Pixel(next_random());
+                }
+                for(auto &d : dst){
+                    d = uint8_t(next_random() >> 24);
+                }
+                Color c = next_random();
+                //Edge colors too
+                if(iter == 0){
+                    c |= 0xFF;
+                }
+                else if(iter == 1){
+                    c &= ~0xFF;
+                }
+                std::vector<uint8_t> expected = dst;
+                CPUTextRenderer::blend_row(dst.data() + offset * 4,src.data() + offset,n,c);
+                CPUTextRenderer::blend_row_scalar(expected.data() + offset * 4,src.data() + offset,n,c);
+                //Also the pixels around the row are untouched
+                TEST_CHECK(dst == expected);
+            }
+        }
+    }
+}
+static void test_coverage(){
+    //Full coverage of opaque color is the color,zero coverage keeps the dst
+    std::vector<Pixel>   src(13);
+    std::vector<uint8_t> dst(13 * 4,0x40);
+    for(size_t i = 0;i < src.size();i++){
+        src[i] = (i % 2) ? Pixel(~0u) : Pixel(0);
+    }
+    CPUTextRenderer::blend_row(dst.data(),src.data(),int(src.size()),0x1080F0FF);
+    for(size_t i = 0;i < src.size();i++){
+        const uint8_t *d = &dst[i * 4];
+        if(i % 2){
+            TEST_CHECK(d[0] == 0x10 && d[1] == 0x80 && d[2] == 0xF0 && d[3] == 0xFF);
+        }
+        else{
+            TEST_CHECK(d[0] == 0x40 && d[1] == 0x40 && d[2] == 0x40 && d[3] == 0x40);
+        }
+    }
+}
+
+int main(){
+    test_widths();
+    test_coverage();
+    return test_result("test_cpu_blend");
+}
@@ -0,0 +1,104 @@
+//CPUTextRenderer with scaled glyphs(SDF and the async placeholder)
+#include "lilim.cpp"
+#include "fontstash.cpp"
+#define FONS_CPU_RENDERER
+#include "fons_backend.hpp"
+#include "test_util.hpp"
+
+using namespace Fons;
+
+static const int width  = 400;
+static const int height = 120;
+
+class Canvas {
+    public:
+        Canvas() : pixels(width * height * 4,0) {}
+
+        //Sum of the coverage(white on black)
+        double ink() const{
+            double sum = 0;
+            for(size_t i = 0;i < pixels.size();i += 4){
+                sum += pixels[i] / 255.0;
+            }
+            return sum;
+        }
+        void clear(){
+            std::fill(pixels.begin(),pixels.end(),0);
+        }
+        std::vector<uint8_t> pixels;
+};
+
+static double draw(CPUTextRenderer &r,Canvas &canvas,float size,const char *text){
+    canvas.clear();
+    r.set_target(canvas.pixels.data(),width,height,width * 4);
+    r.set_size(size);
+    r.draw_text(10,10,text);
+    r.flush();
+    return canvas.ink();
+}
+
+static void test_sdf(Fontstash &stash,int font){
+    CPUTextRenderer r(stash);
+    r.set_font(font);
+    r.set_color(0xFFFFFFFF);
+    r.set_align(FONS_ALIGN_LEFT | FONS_ALIGN_TOP);
+    Canvas canvas;
+    //Same ink as the coverage glyphs,at the SDF size and scaled
+    for(float size : {24.0f,float(FONS_SDF_SIZE),72.0f}){
+        r.set_sdf(false);
+        double coverage = draw(r,canvas,size,"Hello SDF");
+        r.set_sdf(true);
+        double sdf = draw(r,canvas,size,"Hello SDF");
+        TEST_CHECK(coverage > 0);
+        TEST_CHECK(sdf > coverage * 0.9 && sdf < coverage * 1.1);
+        //Decoded,so the edges are sharp instead of the raw distance field
+        int gray = 0;
+        int ink  = 0;
+        for(size_t i = 0;i < canvas.pixels.size();i += 4){
+            uint8_t v = canvas.pixels[i];
+            ink  += v != 0;
+            gray += v > 0x20 && v < 0xE0;
+        }
+        TEST_CHECK(gray < ink / 2);
+    }
+}
+static void test_placeholder(Fontstash &stash,int font){
+    CPUTextRenderer r(stash);
+    r.set_font(font);
+    r.set_color(0xFFFFFFFF);
+    r.set_align(FONS_ALIGN_LEFT | FONS_ALIGN_TOP);
+    r.set_async(true);
+    r.set_placeholder(true);
+    Canvas canvas;
+    //The glyphs are unresolved until polled,so boxes are drawn
+    double boxes = draw(r,canvas,40,"MW");
+    TEST_CHECK(r.last_ticket() != 0);
+    int covered = 0;
+    for(size_t i = 0;i < canvas.pixels.size();i += 4){
+        covered += canvas.pixels[i] != 0;
+    }
+    //Two boxes of the glyph sizes,not a pixel
+    TEST_CHECK(covered > 2 * 20 * 20);
+    TEST_CHECK(boxes > 0);
+
+    r.wait_glyphs();
+    double glyphs = draw(r,canvas,40,"MW");
+    TEST_CHECK(r.last_ticket() == 0);
+    TEST_CHECK(glyphs > 0);
+}
+
+int main(){
+    Lilim::Manager manager;
+    auto face = manager.new_face(TEST_FONT,0);
+    TEST_CHECK(!face.empty());
+    if(face.empty()){
+        return test_result("test_cpu_renderer");
+    }
+    face->set_dpi(96,96);
+    Fontstash stash(manager);
+    int font = stash.add_font(face);
+
+    test_sdf(stash,font);
+    test_placeholder(stash,font);
+    return test_result("test_cpu_renderer");
+}
@@ -0,0 +1,120 @@
+//Draw text by GLTextRenderer in a headless EGL context,read back and compare with CPUTextRenderer
+#define GL_GLEXT_PROTOTYPES
+#include <GL/glcorearb.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include "lilim.cpp"
+#include "fontstash.cpp"
+#define FONS_GL_RENDERER
+#define FONS_CPU_RENDERER
+#include "fons_backend.hpp"
+#include "test_util.hpp"
+#include <cstdlib>
+
+using namespace Fons;
+
+static const int width  = 320;
+static const int height = 200;
+
+//Surfaceless context,false if the platform doesn't have it
+static bool create_context(){
+    auto get_display = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(
+        eglGetProcAddress("eglGetPlatformDisplayEXT")
+    );
+    if(get_display == nullptr){
+        return false;
+    }
+    EGLDisplay display = get_display(EGL_PLATFORM_SURFACELESS_MESA,EGL_DEFAULT_DISPLAY,nullptr);
+    if(display == EGL_NO_DISPLAY || !eglInitialize(display,nullptr,nullptr)){
+        return false;
+    }
+    eglBindAPI(EGL_OPENGL_API);
+    EGLint attrs[] = {
+        EGL_CONTEXT_MAJOR_VERSION,3,
+        EGL_CONTEXT_MINOR_VERSION,3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK,EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    EGLContext context = eglCreateContext(display,EGL_NO_CONFIG_KHR,EGL_NO_CONTEXT,attrs);
+    if(context == EGL_NO_CONTEXT){
+        return false;
+    }
+    return eglMakeCurrent(display,EGL_NO_SURFACE,EGL_NO_SURFACE,context);
+}
+//Same text for both renderers,integer positions so the CPU rounding is exact
+template <class Renderer>
+static void draw_text(Renderer &r,int font){
+    r.set_font(font);
+    r.set_color(0xFFFFFFFF);
+    r.set_align(FONS_ALIGN_LEFT | FONS_ALIGN_TOP);
+    r.set_size(20);
+    r.draw_text(3,5,"Hello GL World AVWa");
+    r.set_size(30);
+    r.draw_text(10,60,"0123456789 abcdefghijkl");
+    r.set_size(11);
+    r.draw_text(0,150,"The Quick Brown Fox Jumps Over The Lazy Dog");
+    r.flush();
+}
+
+int main(){
+    if(!create_context()){
+        std::printf("test_gl_renderer: skipped(no surfaceless EGL)\n");
+        return 0;
+    }
+    GLuint fbo,rbo;
+    glGenFramebuffers(1,&fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER,fbo);
+    glGenRenderbuffers(1,&rbo);
+    glBindRenderbuffer(GL_RENDERBUFFER,rbo);
+    glRenderbufferStorage(GL_RENDERBUFFER,GL_RGBA8,width,height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,GL_RENDERBUFFER,rbo);
+    TEST_CHECK(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+    glViewport(0,0,width,height);
+    glClearColor(0,0,0,1);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    Lilim::Manager manager;
+    auto face = manager.new_face(TEST_FONT,0);
+    TEST_CHECK(!face.empty());
+    if(face.empty()){
+        return test_result("test_gl_renderer");
+    }
+    face->set_dpi(96,96);
+    Fontstash stash(manager);
+    int font = stash.add_font(face);
+
+    //Small atlas,so the text takes several pages(layers)
+    GLTextRenderer gl(stash,64,64);
+    draw_text(gl,font);
+    std::vector<uint8_t> pixels(width * height * 4);
+    glReadPixels(0,0,width,height,GL_RGBA,GL_UNSIGNED_BYTE,pixels.data());
+    TEST_CHECK(glGetError() == GL_NO_ERROR);
+
+    std::vector<uint8_t> expected(width * height * 4);
+    for(size_t i = 0;i < expected.size();i += 4){
+        expected[i + 3] = 0xFF;
+    }
+    CPUTextRenderer cpu(stash,64,64);
+    cpu.set_target(expected.data(),width,height,width * 4);
+    draw_text(cpu,font);
+
+    //GL rows are bottom up
+    int  max_diff = 0;
+    long covered  = 0;
+    for(int y = 0;y < height;y++){
+        for(int x = 0;x < width;x++){
+            const uint8_t *a = &pixels[((height - 1 - y) * width + x) * 4];
+            const uint8_t *b = &expected[(y * width + x) * 4];
+            for(int c = 0;c < 3;c++){
+                max_diff = std::max(max_diff,std::abs(a[c] - b[c]));
+            }
+            covered += a[0];
+        }
+    }
+    TEST_CHECK(covered > 0);
+    TEST_CHECK(max_diff <= 1);
+    if(max_diff > 1){
+        std::fprintf(stderr,"max diff %d\n",max_diff);
+    }
+    return test_result("test_gl_renderer");
+}
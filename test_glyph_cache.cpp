@@ -0,0 +1,134 @@
+//Unit tests of GlyphCache
+#include "lilim.cpp"
+#include "fontstash.cpp"
+#include "test_util.hpp"
+
+using namespace Fons;
+
+static FontParams key_of(char32_t codepoint,short size){
+    FontParams param;
+    param.context = nullptr;
+    param.codepoint = codepoint;
+    param.blur = 0;
+    param.size = size;
+    param.flags = 0;
+    param.subpixel = 0;
+    return param;
+}
+
+static void test_insert_find(){
+    GlyphCache cache;
+    TEST_CHECK(cache.find(key_of('A',12)) == nullptr);
+    //Past the first capacity,so the table is rehashed several times
+    for(char32_t c = 0;c < 1000;c++){
+        Glyph *g = cache.insert(key_of(c,12));
+        g->x = int(c);
+    }
+    TEST_CHECK(cache.size() == 1000);
+    for(char32_t c = 0;c < 1000;c++){
+        Glyph *g = cache.find(key_of(c,12));
+        TEST_CHECK(g != nullptr && g->x == int(c) && g->codepoint == c);
+        //Different size is a different key
+        TEST_CHECK(cache.find(key_of(c,13)) == nullptr);
+    }
+}
+static void test_erase(){
+    GlyphCache cache;
+    std::vector<Glyph*> glyphs;
+    for(char32_t c = 0;c < 300;c++){
+        glyphs.push_back(cache.insert(key_of(c,20)));
+    }
+    //Pointers are stable after rehash
+    Glyph *first = cache.find(key_of(0,20));
+    TEST_CHECK(first == glyphs[0]);
+    for(char32_t c = 0;c < 300;c += 2){
+        cache.erase(glyphs[c]);
+    }
+    TEST_CHECK(cache.size() == 150);
+    for(char32_t c = 0;c < 300;c++){
+        Glyph *g = cache.find(key_of(c,20));
+        TEST_CHECK((c % 2 == 0) ? g == nullptr : g == glyphs[c]);
+    }
+    //Erased slots are reused
+    Glyph *g = cache.insert(key_of(1000,20));
+    TEST_CHECK(g->x == -1 && g->ticket == 0);
+    TEST_CHECK(cache.size() == 151);
+    cache.clear();
+    TEST_CHECK(cache.size() == 0 && cache.find(key_of(1,20)) == nullptr);
+}
+static void test_erase_if(){
+    GlyphCache cache;
+    for(char32_t c = 0;c < 500;c++){
+        cache.insert(key_of(c,16))->x = int(c);
+    }
+    cache.erase_if([](Glyph &g){
+        return g.codepoint % 3 == 0;
+    });
+    size_t visited = 0;
+    cache.for_each([&](Glyph &g){
+        TEST_CHECK(g.codepoint % 3 != 0);
+        visited++;
+    });
+    TEST_CHECK(visited == cache.size());
+    for(char32_t c = 0;c < 500;c++){
+        Glyph *g = cache.find(key_of(c,16));
+        TEST_CHECK((c % 3 == 0) ? g == nullptr : (g != nullptr && g->x == int(c)));
+    }
+}
+//Load the font file into a blob,flag is set when the blob is released
+static Ref<Blob> load_blob(bool *released){
+    FILE *fp = std::fopen(TEST_FONT,"rb");
+    if(fp == nullptr){
+        return {};
+    }
+    std::fseek(fp,0,SEEK_END);
+    size_t size = std::ftell(fp);
+    std::fseek(fp,0,SEEK_SET);
+    void *data = std::malloc(size);
+    size_t n = std::fread(data,1,size,fp);
+    std::fclose(fp);
+    if(n != size){
+        std::free(data);
+        return {};
+    }
+    Ref<Blob> blob = new Blob(data,size);
+    blob->set_finalizer([](void *data,size_t,void *user){
+        std::free(data);
+        *static_cast<bool*>(user) = true;
+    },released);
+    return blob;
+}
+//Erased glyphs must not keep their faces alive
+static void test_erase_releases_face(){
+    bool released[2] = {false,false};//< Outlive the cache
+    Manager manager;
+    GlyphCache cache;
+    for(int pass = 0;pass < 2;pass++){
+        Ref<Blob> blob = load_blob(&released[pass]);
+        TEST_CHECK(!blob.empty());
+        if(blob.empty()){
+            return;
+        }
+        Glyph *g = cache.insert(key_of('A',12 + pass));
+        g->face = manager.new_face(blob,0);
+        blob.release();
+        TEST_CHECK(!released[pass]);
+        if(pass == 0){
+            cache.erase(g);
+        }
+        else{
+            cache.erase_if([](Glyph &){
+                return true;
+            });
+        }
+        TEST_CHECK(released[pass]);
+    }
+}
+
+int main(){
+    test_insert_find();
+    test_erase();
+    test_erase_if();
+    test_erase_releases_face();
+    return test_result("test_glyph_cache");
+}
@@ -0,0 +1,111 @@
+//LRU eviction of the glyph cache(small limits to fill it quickly)
+#define FONS_MAX_CACHED_GLYPHS 64
+#define FONS_EVICT_GLYPHS 8
+#include "lilim.cpp"
+#include "fontstash.cpp"
+#include "test_util.hpp"
+
+using namespace Fons;
+
+//Expose the atlas of the context
+class Probe : public Context {
+    public:
+        using Context::Context;
+
+        Glyph *cached(Font *font,const FontParams &param){
+            auto it = shards.find(font->get_id());
+            return it == shards.end() ? nullptr : it->second->glyphs.find(param);
+        }
+        bool  is_free(int page,int x,int y,int w,int h){
+            for(auto &r : pages[page]->atlas.free_rects){
+                if(x >= r.x && y >= r.y && x + w <= r.x + r.width && y + h <= r.y + r.height){
+                    return true;
+                }
+            }
+            return false;
+        }
+        int   free_area() const{
+            return Context::free_area();
+        }
+};
+
+static FontParams key_of(Context &ctxt,char32_t codepoint){
+    FontParams param;
+    param.context = &ctxt;
+    param.codepoint = codepoint;
+    param.blur = 0;
+    param.size = 20;
+    param.flags = 0;
+    param.subpixel = 0;
+    return param;
+}
+
+int main(){
+    Manager manager;
+    Fontstash stash(manager);
+    auto face = manager.new_face(TEST_FONT,0);
+    TEST_CHECK(!face.empty());
+    if(face.empty()){
+        return test_result("test_glyph_evict");
+    }
+    face->set_dpi(96,96);
+    Font *font = stash.get_font(stash.add_font(face));
+    Probe ctxt(stash,1024,1024);
+
+    //4 frames of 16 glyphs fill the cache
+    const int per_frame = 16;
+    for(int frame = 0;frame < 4;frame++){
+        for(int i = 0;i < per_frame;i++){
+            TEST_CHECK(font->get_glyph(key_of(ctxt,'A' + frame * per_frame + i),FONS_GLYPH_BITMAP_REQUIRED) != nullptr);
+        }
+        ctxt.next_frame();
+    }
+    CacheStats stats = font->cache_stats();
+    TEST_CHECK(stats.misses == 64 && stats.hits == 0 && stats.evictions == 0);
+
+    //Use the glyphs of the frame 1 again,so the frame 0 is the oldest
+    for(int i = 0;i < per_frame;i++){
+        font->get_glyph(key_of(ctxt,'A' + per_frame + i),FONS_GLYPH_BITMAP_REQUIRED);
+    }
+    stats = font->cache_stats();
+    TEST_CHECK(stats.hits == per_frame && stats.misses == 64);
+    ctxt.next_frame();
+
+    //Remember the rects of the oldest frame
+    struct Rect {
+        int page,x,y,w,h;
+    };
+    std::vector<Rect> oldest;
+    for(int i = 0;i < per_frame;i++){
+        Glyph *g = ctxt.cached(font,key_of(ctxt,'A' + i));
+        TEST_CHECK(g != nullptr && g->x >= 0);
+        oldest.push_back({g->page,g->x,g->y,g->width,g->height});
+    }
+    int free_before = ctxt.free_area();
+
+    //A miss past the limit evicts FONS_EVICT_GLYPHS of the oldest frame(metrics only,so no rect is reused)
+    TEST_CHECK(font->get_glyph(key_of(ctxt,0x3B1),FONS_GLYPH_BITMAP_OPTIONAL) != nullptr);
+    stats = font->cache_stats();
+    TEST_CHECK(stats.evictions == FONS_EVICT_GLYPHS);
+    TEST_CHECK(stats.misses == 65);
+
+    int evicted = 0;
+    int evicted_area = 0;
+    for(int i = 0;i < per_frame;i++){
+        if(ctxt.cached(font,key_of(ctxt,'A' + i)) != nullptr){
+            continue;
+        }
+        auto &r = oldest[i];
+        evicted++;
+        evicted_area += r.w * r.h;
+        //The space is back to the atlas
+        TEST_CHECK(ctxt.is_free(r.page,r.x,r.y,r.w,r.h));
+    }
+    TEST_CHECK(evicted == FONS_EVICT_GLYPHS);
+    TEST_CHECK(ctxt.free_area() - free_before == evicted_area);
+    //Newer frames are untouched
+    for(int i = per_frame;i < per_frame * 4;i++){
+        TEST_CHECK(ctxt.cached(font,key_of(ctxt,'A' + i)) != nullptr);
+    }
+    return test_result("test_glyph_evict");
+}
@@ -0,0 +1,115 @@
+//Prewarming is bounded by the glyph cache and safe when the atlas is reset(small limits to fill it quickly)
+#define FONS_MAX_CACHED_GLYPHS 64
+#define FONS_EVICT_GLYPHS 8
+#include "lilim.cpp"
+#include "fontstash.cpp"
+#include "test_util.hpp"
+
+using namespace Fons;
+
+//Expose the cache of the context
+class Probe : public Context {
+    public:
+        using Context::Context;
+
+        size_t cached(Font *font){
+            auto it = shards.find(font->get_id());
+            return it == shards.end() ? 0 : it->second->glyphs.size();
+        }
+        //Count the prewarmed glyphs with a bitmap in the atlas
+        int    rendered(Font *font){
+            int n = 0;
+            shards.find(font->get_id())->second->glyphs.for_each([&](Glyph &g){
+                if(g.x < 0 || g.y < 0){
+                    return;
+                }
+                int w;
+                auto pixels = static_cast<const Pixel*>(get_data(g.page,&w,nullptr));
+                bool ink = false;
+                for(int y = 0;y < g.height && !ink;y++){
+                    for(int x = 0;x < g.width && !ink;x++){
+                        ink = pixels[(g.y + y) * w + g.x + x] != 0;
+                    }
+                }
+                n += ink;
+            });
+            return n;
+        }
+};
+
+static void test_bounded(Fontstash &stash,int id){
+    Font *font = stash.get_font(id);
+    Probe ctxt(stash,1024,1024);
+    ctxt.set_font(id);
+
+    //Far more than the cache holds in one frame
+    CodepointRange latin = {0x21,0x17F};
+    float size = 16;
+    int count = ctxt.prewarm(&latin,1,&size,1);
+    TEST_CHECK(count > 0);
+    TEST_CHECK(count <= FONS_MAX_CACHED_GLYPHS);
+    TEST_CHECK(ctxt.cached(font) <= FONS_MAX_CACHED_GLYPHS);
+    TEST_CHECK(ctxt.rendered(font) == count);
+
+    //Older frames are evicted for the new glyphs
+    ctxt.next_frame();
+    CodepointRange greek = {0x391,0x3C9};
+    count = ctxt.prewarm(&greek,1,&size,1);
+    TEST_CHECK(count > 0);
+    TEST_CHECK(ctxt.cached(font) <= FONS_MAX_CACHED_GLYPHS);
+}
+//The handler starts over on a full atlas while the rects are reserved
+static void test_reset(Fontstash &stash,int id){
+    Font *font = stash.get_font(id);
+    Probe ctxt(stash,64,64);
+    int resets = 0;
+    struct Self {
+        Probe *ctxt;
+        int   *resets;
+    } self = {&ctxt,&resets};
+    ctxt.set_error_handler([](void *uptr,int code,int) -> bool{
+        auto s = static_cast<Self*>(uptr);
+        if(code != FONS_ATLAS_FULL){
+            return false;
+        }
+        (*s->resets)++;
+        s->ctxt->reset_atlas(64,64);
+        return true;
+    },&self);
+    ctxt.set_font(id);
+
+    CodepointRange upper = {'A','Z'};
+    float size = 30;
+    int count = ctxt.prewarm(&upper,1,&size,1);
+    TEST_CHECK(resets > 0);
+    TEST_CHECK(count == 0);
+    TEST_CHECK(ctxt.cached(font) == 0);
+
+    //Still usable after
+    FontParams param;
+    param.context = &ctxt;
+    param.codepoint = 'A';
+    param.size = 30;
+    param.blur = 0;
+    param.flags = 0;
+    param.subpixel = 0;
+    Glyph *g = font->get_glyph(param,FONS_GLYPH_BITMAP_REQUIRED);
+    TEST_CHECK(g != nullptr && g->x >= 0);
+    TEST_CHECK(ctxt.rendered(font) == 1);
+}
+
+int main(){
+    Manager manager;
+    Fontstash stash(manager);
+    auto face = manager.new_face(TEST_FONT,0);
+    TEST_CHECK(!face.empty());
+    if(face.empty()){
+        return test_result("test_prewarm");
+    }
+    face->set_dpi(96,96);
+    int id = stash.add_font(face);
+
+    test_bounded(stash,id);
+    test_reset(stash,id);
+    return test_result("test_prewarm");
+}
@@ -0,0 +1,147 @@
+//Rasterizing by the raster threads draws the same as the calling thread,also when the atlas is reset in layout
+#include "lilim.cpp"
+#include "fontstash.cpp"
+#include "test_util.hpp"
+
+using namespace Fons;
+
+//Hash the vertices and the glyph bitmaps they point to
+class HashRenderer : public TextRenderer {
+    public:
+        HashRenderer(Fontstash &stash,int w,int h,bool reset_on_full = false) : TextRenderer(stash,w,h){
+            if(reset_on_full){
+                //Like the classic fontstash usage,start over on a full atlas
+                set_error_handler([](void *self,int code,int) -> bool{
+                    if(code != FONS_ATLAS_FULL){
+                        return false;
+                    }
+                    auto r = static_cast<HashRenderer*>(self);
+                    r->resets++;
+                    r->reset(r->atlas_size().width,r->atlas_size().height);
+                    return true;
+                },this);
+            }
+        }
+
+        uint64_t hash = test_hash(nullptr,0);
+        int      vertices = 0;
+        int      resets = 0;
+    private:
+        void render_update(int,int,int,int,int) override{}
+        void render_resize(int,int) override{}
+        void render_flush() override{}
+        void render_draw(const Vertex *verts,int nverts) override{
+            vertices += nverts;
+            for(int i = 0;i < nverts;i++){
+                const Vertex &v = verts[i];
+                hash = test_hash(&v.screen_x,sizeof(float) * 4,hash);
+                hash = test_hash(&v.glyph_w,sizeof(int) * 2,hash);
+                int w;
+                auto pixels = static_cast<const Pixel*>(get_data(v.page,&w,nullptr));
+                for(int y = 0;y < v.glyph_h;y++){
+                    hash = test_hash(pixels + (v.glyph_y + y) * w + v.glyph_x,v.glyph_w * sizeof(Pixel),hash);
+                }
+            }
+        }
+};
+
+static const char *texts[] = {
+    "The quick brown fox jumps over the lazy dog",
+    "THE QUICK BROWN FOX JUMPS OVER THE LAZY DOG",
+    "0123456789 !@#$%^&*() AVWa To Ty",
+};
+
+static void draw_frames(HashRenderer &r,int font){
+    r.set_font(font);
+    r.set_color(0xFFFFFFFF);
+    for(int frame = 0;frame < 6;frame++){
+        for(int size = 10;size < 60;size += 7){
+            r.set_size(size);
+            r.set_subpixel(frame % 2 == 1);
+            r.set_blur(frame % 3 == 2 ? 3 : 0);
+            for(const char *text : texts){
+                r.draw_text(2.5f,40,text);
+                r.flush();
+            }
+        }
+    }
+}
+
+static void test_pool_matches_serial(Fontstash &stash,int font){
+    HashRenderer serial(stash,256,256);
+    draw_frames(serial,font);
+
+    HashRenderer pooled(stash,256,256);
+    pooled.set_raster_threads(4);
+    draw_frames(pooled,font);
+
+    TEST_CHECK(serial.vertices > 0);
+    TEST_CHECK(pooled.vertices == serial.vertices);
+    TEST_CHECK(pooled.hash == serial.hash);
+}
+//The atlas is full in the middle of a run,the run is laid out again in the empty atlas
+static void test_reset_in_layout(Fontstash &stash,int font,int threads){
+    const char *first  = "abcdefghijklmnopqrstuvwxyz";
+    const char *second = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    //The second fits an empty page alone,not with the first(FreeType and stb_truetype)
+    const int atlas = 128;
+    const int size  = 20;
+
+    HashRenderer r(stash,atlas,atlas,true);
+    r.set_raster_threads(threads);
+    r.set_font(font);
+    r.set_color(0xFFFFFFFF);
+    r.set_size(size);
+    r.draw_text(0,30,first);
+    r.flush();
+    int before = r.resets;
+    r.hash = test_hash(nullptr,0);
+    r.vertices = 0;
+    r.draw_text(0,30,second);
+    r.flush();
+    TEST_CHECK(r.resets > before);
+    TEST_CHECK(r.vertices == 26);
+
+    //Same as drawing it in an empty atlas
+    HashRenderer expected(stash,atlas,atlas);
+    expected.set_font(font);
+    expected.set_color(0xFFFFFFFF);
+    expected.set_size(size);
+    expected.draw_text(0,30,second);
+    expected.flush();
+    TEST_CHECK(expected.resets == 0);
+    TEST_CHECK(r.hash == expected.hash);
+}
+//The string never fits,the glyphs after the last reset are still drawn
+static void test_reset_every_try(Fontstash &stash,int font,int threads){
+    const char *text = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+    HashRenderer r(stash,64,64,true);
+    r.set_raster_threads(threads);
+    r.set_font(font);
+    r.set_color(0xFFFFFFFF);
+    r.set_size(24);
+    r.draw_text(0,30,text);
+    r.flush();
+    TEST_CHECK(r.resets >= 2);
+    TEST_CHECK(r.vertices > 0 && r.vertices < 26);
+}
+
+int main(){
+    Lilim::Manager manager;
+    auto face = manager.new_face(TEST_FONT,0);
+    TEST_CHECK(!face.empty());
+    if(face.empty()){
+        return test_result("test_raster_pool");
+    }
+    face->set_dpi(96,96);
+    Fontstash stash(manager);
+    int font = stash.add_font(face);
+
+    test_pool_matches_serial(stash,font);
+    test_reset_in_layout(stash,font,1);
+    test_reset_in_layout(stash,font,4);
+    test_reset_every_try(stash,font,1);
+    test_reset_every_try(stash,font,4);
+    return test_result("test_raster_pool");
+}
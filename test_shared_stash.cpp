@@ -0,0 +1,109 @@
+//Contexts in several threads sharing a Fontstash draw the same as a single thread
+#include "lilim.cpp"
+#include "fontstash.cpp"
+#include "test_util.hpp"
+#include <atomic>
+#include <thread>
+
+using namespace Fons;
+
+#ifndef TEST_THREADS
+    #define TEST_THREADS 8
+#endif
+
+//Hash the vertices and the glyph bitmaps they point to
+class HashRenderer : public TextRenderer {
+    public:
+        using TextRenderer::TextRenderer;
+
+        uint64_t hash = test_hash(nullptr,0);
+    private:
+        void render_update(int,int,int,int,int) override{}
+        void render_resize(int,int) override{}
+        void render_flush() override{}
+        void render_draw(const Vertex *vertices,int nvertices) override{
+            for(int i = 0;i < nvertices;i++){
+                const Vertex &v = vertices[i];
+                hash = test_hash(&v.screen_x,sizeof(float) * 4,hash);
+                hash = test_hash(&v.glyph_w,sizeof(int) * 2,hash);
+                int w;
+                auto pixels = static_cast<const Pixel*>(get_data(v.page,&w,nullptr));
+                for(int y = 0;y < v.glyph_h;y++){
+                    hash = test_hash(pixels + (v.glyph_y + y) * w + v.glyph_x,v.glyph_w * sizeof(Pixel),hash);
+                }
+            }
+        }
+};
+
+static const char *texts[] = {
+    "The quick brown fox jumps over the lazy dog AVWa",
+    "0123456789 Illinois ffi fl",
+    //Not in the mono font,found by the fallback query
+    "\xc7\x84\xc7\x85\xc7\x86 \xc8\xa2\xc8\xa3 \xc9\x86\xc9\x87\xc9\x88",
+    "\xca\xba\xcb\x82\xcb\x83\xcb\x84 \xcb\x8a\xcb\x8b",
+};
+
+static uint64_t work(Fontstash &stash,int font){
+    //Small atlas,so glyphs are evicted and the atlas grows
+    HashRenderer r(stash,256,256);
+    r.set_font(font);
+    r.set_color(0xFFFFFFFF);
+    for(int frame = 0;frame < 10;frame++){
+        for(int size = 8;size < 48;size += 5){
+            r.set_size(size);
+            r.set_subpixel(frame % 2 == 1);
+            r.set_blur(frame % 5 == 0 ? 2 : 0);
+            for(const char *text : texts){
+                r.draw_text(1.25f,30,text);
+                Size s = r.measure_text(text);
+                r.hash = test_hash(&s,sizeof(s),r.hash);
+                r.flush();
+            }
+        }
+    }
+    return r.hash;
+}
+//Run the work on a new stash in n threads at once
+static std::vector<uint64_t> run(Lilim::Manager &manager,int n,std::atomic<int> &queries){
+    auto face = manager.new_face(TEST_FONT2,0);
+    auto fallback_face = manager.new_face(TEST_FONT,0);
+    face->set_dpi(96,96);
+    fallback_face->set_dpi(96,96);
+
+    Fontstash stash(manager);
+    int font = stash.add_font(face);
+    int fallback = stash.add_font(fallback_face);
+    //Faces are not shared between threads,so don't query the codepoint here
+    stash.set_fallback_query([&stash,&queries,fallback](char32_t) -> Font*{
+        queries++;
+        return stash.get_font(fallback);
+    });
+
+    std::vector<uint64_t> hashes(n);
+    std::vector<std::thread> threads;
+    for(int i = 0;i < n;i++){
+        threads.emplace_back([&,i](){
+            hashes[i] = work(stash,font);
+        });
+    }
+    for(auto &t : threads){
+        t.join();
+    }
+    return hashes;
+}
+
+int main(){
+    Lilim::Manager manager;
+    auto face = manager.new_face(TEST_FONT2,0);
+    TEST_CHECK(!face.empty());
+    if(face.empty()){
+        return test_result("test_shared_stash");
+    }
+    std::atomic<int> queries{0};
+    uint64_t expected = run(manager,1,queries)[0];
+    TEST_CHECK(queries > 0);
+    for(uint64_t hash : run(manager,TEST_THREADS,queries)){
+        TEST_CHECK(hash == expected);
+    }
+    return test_result("test_shared_stash");
+}
@@ -0,0 +1,74 @@
+//TextIter moves str and next by one char for each glyph,from the laid out run or decoding
+#include "lilim.cpp"
+#include "fontstash.cpp"
+#include "test_util.hpp"
+#include <string>
+
+using namespace Fons;
+
+//Start of each char by the single decoder
+static std::vector<const char*> starts_of(const char *str,const char *end){
+    std::vector<const char*> starts;
+    while(str < end){
+        starts.push_back(str);
+        char32_t c;
+        Utf8Decode(str,end,&c,1);
+    }
+    starts.push_back(end);
+    return starts;
+}
+
+//Walk the string,the run is dropped at the glyph invalidate_at(-1 for never)
+static void check_positions(Context &ctxt,const std::string &text,int invalidate_at){
+    const char *begin = text.data();
+    const char *end   = begin + text.size();
+    auto starts = starts_of(begin,end);
+
+    TextIter iter;
+    Quad     quad;
+    TEST_CHECK(iter.init(&ctxt,0,0,begin,end,FONS_GLYPH_BITMAP_OPTIONAL));
+    size_t n = 0;
+    while(iter.to_next(&quad)){
+        if(n + 1 >= starts.size()){
+            TEST_CHECK(!"Too many glyphs");
+            break;
+        }
+        TEST_CHECK(iter.next == starts[n]);
+        TEST_CHECK(iter.str == starts[n + 1]);
+        n++;
+        if(int(n) == invalidate_at){
+            ctxt.next_frame();
+        }
+    }
+    TEST_CHECK(n + 1 == starts.size());
+    TEST_CHECK(iter.str == end);
+}
+
+int main(){
+    Lilim::Manager manager;
+    auto face = manager.new_face(TEST_FONT,0);
+    TEST_CHECK(!face.empty());
+    if(face.empty()){
+        return test_result("test_text_iter");
+    }
+    face->set_dpi(96,96);
+    Fontstash stash(manager);
+    int font = stash.add_font(face);
+
+    Context ctxt(stash,512,512);
+    ctxt.set_font(font);
+    ctxt.set_size(16);
+
+    std::string ascii = "The quick brown fox jumps over the lazy dog";
+    //2,3 and 4 bytes chars,also across the decode chunks
+    std::string mixed;
+    for(int i = 0;i < 12;i++){
+        mixed += "ab\xc3\xa9\xce\xb1\xd0\x96 \xe2\x82\xac\xe4\xbd\xa0\xf0\x9f\x98\x80.";
+    }
+    for(const std::string *text : {&ascii,&mixed}){
+        check_positions(ctxt,*text,-1);
+        check_positions(ctxt,*text,1);
+        check_positions(ctxt,*text,int(text->size() / 3));
+    }
+    return test_result("test_text_iter");
+}
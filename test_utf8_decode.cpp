@@ -0,0 +1,122 @@
+//Bulk UTF8 decoding(SIMD if available) against the one codepoint decoder
+#include "lilim.cpp"
+#include "test_util.hpp"
+#include <string>
+
+using namespace Lilim;
+
+//Decode by the scalar one codepoint decoder,the string is null terminated
+static std::u32string decode_scalar(const std::string &str){
+    std::u32string ret;
+    const char *cur = str.c_str();
+    const char *end = cur + str.size();
+    while(cur < end){
+        ret.push_back(Utf8Decode(cur));
+    }
+    return ret;
+}
+//Decode by the bulk decoder,at most n codepoints per call
+static std::u32string decode_bulk(const std::string &str,size_t n){
+    std::u32string ret;
+    std::vector<char32_t> buffer(n);
+    const char *cur = str.data();
+    const char *end = cur + str.size();
+    while(cur < end){
+        size_t count = Utf8Decode(cur,end,buffer.data(),n);
+        if(count == 0 || count > n){
+            //No progress
+            TEST_CHECK(count != 0 && count <= n);
+            break;
+        }
+        ret.append(buffer.data(),count);
+    }
+    TEST_CHECK(cur == end);
+    return ret;
+}
+static void check_same(const std::string &str){
+    std::u32string expected = decode_scalar(str);
+    //Limits around the vector widths
+    for(size_t n : {1,3,15,16,17,31,32,33,64,LILIM_DECODE_CHUNK}){
+        TEST_CHECK(decode_bulk(str,n) == expected);
+    }
+}
+
+static void test_known(){
+    struct {
+        const char    *str;
+        std::u32string expected;
+    } cases[] = {
+        {"abc",             U"abc"},
+        {"\xc3\xa9",        U"\u00e9"},
+        {"\xe4\xb8\xad",    U"\u4e2d"},
+        {"\xf0\x9f\x98\x80",U"\U0001f600"},
+        //Stray continuation / invalid lead
+        {"\x80" "a",        U"\ufffd" "a"},
+        {"\xff" "a",        U"\ufffd" "a"},
+        //Overlong
+        {"\xc0\x80",        U"\ufffd\ufffd"},
+        {"\xe0\x80\x80",    U"\ufffd\ufffd\ufffd"},
+        //Surrogate,out of range
+        {"\xed\xa0\x80",    U"\ufffd\ufffd\ufffd"},
+        {"\xf4\x90\x80\x80",U"\ufffd\ufffd\ufffd\ufffd"},
+        //Truncated in the middle and at the end
+        {"\xe4\xb8" "a",    U"\ufffd\ufffd" "a"},
+        {"a\xe4\xb8",       U"a\ufffd\ufffd"},
+    };
+    for(auto &c : cases){
+        std::string str = c.str;
+        TEST_CHECK(decode_scalar(str) == c.expected);
+        TEST_CHECK(decode_bulk(str,LILIM_DECODE_CHUNK) == c.expected);
+    }
+}
+//Put every kind of sequence across the 16 / 32 bytes chunk boundaries
+static void test_boundaries(){
+    const char *pieces[] = {
+        "\xc3\xa9",
+        "\xe4\xb8\xad",
+        "\xf0\x9f\x98\x80",
+        "\x80",
+        "\xff",
+        "\xc0\x80",
+        "\xe0\x80\x80",
+        "\xed\xa0\x80",
+        "\xf4\x90\x80\x80",
+        "\xe4\xb8",
+        "\xf0\x9f\x98",
+    };
+    for(const char *piece : pieces){
+        for(int prefix = 0;prefix <= 40;prefix++){
+            for(int suffix : {0,1,15,16,17,40}){
+                std::string str(prefix,'a');
+                str += piece;
+                str += std::string(suffix,'b');
+                check_same(str);
+            }
+        }
+    }
+}
+static void test_random(){
+    uint32_t seed = 12345;
+    auto next = [&](){
+        seed = seed * 1664525u + 1013904223u;
+        return seed >> 8;
+    };
+    for(int iter = 0;iter < 2000;iter++){
+        std::string str;
+        size_t len = next() % 100;
+        for(size_t i = 0;i < len;i++){
+            //Mostly ASCII,so both the SIMD and scalar paths are taken
+            uint32_t r = next();
+            char ch = (r % 4 == 0) ? char(0x80 | (r >> 4) % 0x80) : char('a' + (r >> 4) % 26);
+            str.push_back(ch);
+        }
+        check_same(str);
+    }
+}
+
+int main(){
+    test_known();
+    test_boundaries();
+    test_random();
+    return test_result("test_utf8_decode");
+}
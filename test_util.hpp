@@ -0,0 +1,45 @@
+#pragma once
+//Helpers for the self checking tests(exit code is non zero on any failed check)
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#ifndef TEST_FONT
+    #ifdef _WIN32
+        #define TEST_FONT "C:/Windows/Fonts/arial.ttf"
+    #else
+        #define TEST_FONT "/usr/share/fonts/truetype/dejavu/DejaVuSans.ttf"
+    #endif
+#endif
+
+//Another font for fallback tests
+#ifndef TEST_FONT2
+    #ifdef _WIN32
+        #define TEST_FONT2 "C:/Windows/Fonts/cour.ttf"
+    #else
+        #define TEST_FONT2 "/usr/share/fonts/truetype/dejavu/DejaVuSansMono.ttf"
+    #endif
+#endif
+
+static int test_failures = 0;
+
+#define TEST_CHECK(X) do{ \
+    if(!(X)){ \
+        std::fprintf(stderr,"%s:%d: check failed: %s\n",__FILE__,__LINE__,#X); \
+        test_failures++; \
+    } \
+}while(0)
+
+static inline int test_result(const char *name){
+    std::printf("%s: %s\n",name,test_failures == 0 ? "passed" : "FAILED");
+    return test_failures == 0 ? 0 : 1;
+}
+//FNV-1a of bytes,for comparing outputs
+static inline uint64_t test_hash(const void *data,size_t n,uint64_t hash = 14695981039346656037ULL){
+    auto bytes = static_cast<const uint8_t*>(data);
+    for(size_t i = 0;i < n;i++){
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
@@ -16,6 +16,10 @@ if has_config("memcheck") then
     add_links("asan")
 end
 
+if is_plat("linux") then
+    add_syslinks("pthread")
+end
+
 if is_plat("windows") then 
     --Let it use UTF-8
     add_cxxflags("/utf-8")
@@ -33,6 +37,51 @@ target("test_cleartype")
     set_kind("binary")
     add_files("test_cleartype.cpp")
 
+-- Self checking tests(xmake run test_xxx,exit code is non zero on failure)
+target("test_glyph_cache")
+    set_kind("binary")
+    add_files("test_glyph_cache.cpp")
+target("test_glyph_evict")
+    set_kind("binary")
+    add_files("test_glyph_evict.cpp")
+target("test_utf8_decode")
+    set_kind("binary")
+    add_files("test_utf8_decode.cpp")
+target("test_blur")
+    set_kind("binary")
+    add_files("test_blur.cpp")
+target("test_cpu_blend")
+    set_kind("binary")
+    add_files("test_cpu_blend.cpp")
+target("test_cpu_renderer")
+    set_kind("binary")
+    add_files("test_cpu_renderer.cpp")
+target("test_shared_stash")
+    set_kind("binary")
+    add_files("test_shared_stash.cpp")
+target("test_raster_pool")
+    set_kind("binary")
+    add_files("test_raster_pool.cpp")
+target("test_async")
+    set_kind("binary")
+    add_files("test_async.cpp")
+target("test_prewarm")
+    set_kind("binary")
+    add_files("test_prewarm.cpp")
+target("test_atlas_cache")
+    set_kind("binary")
+    add_files("test_atlas_cache.cpp")
+target("test_text_iter")
+    set_kind("binary")
+    add_files("test_text_iter.cpp")
+if is_plat("linux") then
+    -- Headless by EGL surfaceless(Mesa),skipped at runtime without it
+    target("test_gl_renderer")
+        set_kind("binary")
+        add_files("test_gl_renderer.cpp")
+        add_syslinks("EGL","GL")
+end
+
 --
 -- If you want to known more usage about xmake, please see https://xmake.io
 --